@@ -5,6 +5,7 @@
 #include "core/property.h"
 #include "core/stringid.h"
 
+#include "emitters/action.h"
 #include "emitters/compilecommands.h"
 #include "emitters/direct.h"
 #include "emitters/ninja.h"
@@ -13,6 +14,7 @@
 #include "modules/bundle.h"
 #include "modules/command.h"
 #include "modules/postprocess.h"
+#include "modules/test.h"
 #include "modules/toolchain.h"
 
 #include "toolchains/cl.h"
@@ -23,6 +25,9 @@
 #include "util/commands.h"
 #include "util/file.h"
 #include "util/glob.h"
+#include "util/hash.h"
 #include "util/main.h"
+#include "util/memory.h"
 #include "util/process.h"
+#include "util/profile.h"
 #include "util/string.h"
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "core/environment.h"
@@ -14,6 +15,8 @@ struct Emitters
 {
     static void install(Emitter* emitter);
     static const std::vector<Emitter*>& list();
+    // Drops emitters installed after the first count, e.g. by an unloaded module.
+    static void truncate(size_t count);
 };
 
 struct Emitter
@@ -33,6 +36,24 @@ struct Emitter
     virtual void emit(Environment& env) = 0;
 
 protected:
+    static constexpr std::string_view generatorProjectName = "_generator";
+    static constexpr std::string_view generatorCoreProjectPrefix = "_buildh_";
+    // Directory in the target path for outputs shared between configurations
+    static constexpr std::string_view sharedDirName = "_shared";
+
+    // Where a configuration built directly from the target path keeps its
+    // data, and the data shared between configurations. Emitters querying
+    // what the build wrote must look in the same places.
+    static std::filesystem::path configDataDir(const std::filesystem::path& targetPath, StringId config)
+    {
+        return targetPath / config.cstr();
+    }
+    static std::filesystem::path sharedDataDir(const std::filesystem::path& targetPath)
+    {
+        return targetPath / sharedDirName;
+    }
 
     static std::pair<Project*, std::filesystem::path> createGeneratorProject(Environment& env, std::filesystem::path targetPath);
+    // True for the generator and the projects it is built from
+    static bool isGeneratorProject(const Project& project);
 };
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <iterator>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -12,13 +15,32 @@ struct Environment
     Environment(cli::Context& cliContext);
     ~Environment();
 
+    // Safe to call from parallelFor tasks.
     Project& createProject(std::string name = {}, std::optional<ProjectType> type = {});
+    Project* findProject(std::string_view name);
     std::vector<Project*> collectProjects();
+    std::vector<Project*> collectProjects(const std::vector<Project*>& roots);
     std::vector<StringId> collectConfigs();
 
+    // Calls function for every item, on as many threads as there are CPUs
+    // available, and returns when all calls are done. Projects created by the
+    // calls are added in the order of the items, as if they had been called
+    // one by one, so the result doesn't depend on timing. They can't be found
+    // with findProject until parallelFor has returned. Tasks may modify the
+    // projects they create, but other shared state needs synchronization.
+    // The first exception thrown, by order of the items, is rethrown.
+    template<typename Container, typename Function>
+    void parallelFor(const Container& items, Function&& function)
+    {
+        auto begin = std::begin(items);
+        runParallel(std::size(items), [&](size_t index) { function(*std::next(begin, index)); });
+    }
+
 private:
+    void runParallel(size_t count, const std::function<void(size_t index)>& function);
     static void collectOrderedProjects(Project* project, std::set<Project*>& collectedProjects, std::vector<Project*>& orderedProjects);
     
+    std::mutex _projectsMutex;
     std::vector<std::unique_ptr<Project>> _projects;
 
 public:
@@ -28,4 +50,11 @@ public:
     const std::filesystem::path buildHDir;
     cli::Context& cliContext;
     std::set<std::filesystem::path> configurationDependencies;
+
+    // Set when running in the hot reload host, where the build configuration
+    // is a shared library loaded next to the host executable.
+    std::filesystem::path generatorModule;
+    // Set by an emitter that has rebuilt the configuration module, asking the
+    // host to load it again and rerun the action.
+    bool reloadRequested = false;
 };
\ No newline at end of file
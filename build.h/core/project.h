@@ -30,9 +30,17 @@ struct ProjectSettings : public PropertyBag
     ListProperty<std::string> defines{this};
     ListProperty<Feature> features{this};
     ListProperty<std::string> frameworks{this};
+    // Header precompiled for each language used by the project's files
     Property<std::filesystem::path> buildPch{this};
+    // Header precompiled like buildPch and included first in every source
     Property<std::filesystem::path> importPch{this};
     Property<std::filesystem::path> dataDir{this};
+    // Data shared between all configurations, e.g. objects placed by
+    // feature::SharedObjects. Everything there is named by a hash of what
+    // produced it, so it's up to date even without a recorded command line.
+    // Only set by DirectBuilder, which builds every configuration with one
+    // graph. Otherwise shared data is kept per configuration in dataDir.
+    Property<std::filesystem::path> sharedDataDir{this};
     Property<const ToolchainProvider*> toolchain{this};
 
     struct Output : public PropertyGroup
@@ -56,6 +64,7 @@ struct ProjectSettings : public PropertyBag
         {
             return static_cast<ExtensionType&>(it->second->get());
         }
+        ArenaScope arenaScope(_arena);
         ExtensionEntry* extensionEntry = new ExtensionEntryImpl<ExtensionType>();
         _extensions.insert({key, std::unique_ptr<ExtensionEntry>(extensionEntry)});
         return static_cast<ExtensionType&>(extensionEntry->get());
@@ -68,10 +77,36 @@ struct ProjectSettings : public PropertyBag
     ProjectSettings()
     { }
 
+    ProjectSettings(std::shared_ptr<std::pmr::memory_resource> arena)
+        : PropertyBag(std::move(arena))
+    { }
+
     ProjectSettings(const ProjectSettings& other)
     {
         *this += other;
     }
+
+    // Estimated heap memory owned by the settings, including extensions
+    size_t heapSize() const
+    {
+        size_t size = PropertyBag::heapSize();
+        for(auto& entry : _extensions)
+        {
+            size += memory::nodeSize(sizeof(entry), 3) + entry.second->memoryUsage();
+        }
+        return size;
+    }
+
+    // Replaces deferred values, including those of extensions, with the
+    // results of their functions
+    void evaluateDeferred()
+    {
+        PropertyBag::evaluateDeferred();
+        for(auto& entry : _extensions)
+        {
+            entry.second->get().evaluateDeferred();
+        }
+    }
     
 private:
     struct ExtensionEntry
@@ -80,6 +115,7 @@ private:
         virtual PropertyBag& get() = 0;
         virtual const PropertyBag& get() const = 0;
         virtual std::unique_ptr<ExtensionEntry> clone() const = 0;
+        virtual size_t memoryUsage() const = 0;
     };
 
     template<typename ExtensionType>
@@ -105,6 +141,11 @@ private:
             return std::unique_ptr<ExtensionEntry>(newExtension);
         }
 
+        virtual size_t memoryUsage() const override
+        {
+            return memory::allocationSize(sizeof(*this)) + extension.heapSize();
+        }
+
         ExtensionType extension;
     };
     
@@ -4,12 +4,17 @@
 #include <filesystem>
 #include <functional>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <type_traits>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "core/os.h"
 #include "core/stringid.h"
+#include "util/memory.h"
 
 enum ProjectType
 {
@@ -116,6 +121,60 @@ struct ConfigSelector
     }
 };
 
+// A property value produced by calling a function, created with deferred().
+// The function is only called when a project using the value is resolved
+// with a matching selector, so expensive values like globbed file lists
+// aren't computed for configurations or targets that aren't built:
+//
+//   project(Windows).files += deferred([]() { return glob::files("src/win32"); });
+//
+// Deferred values are only part of resolved settings, and reading the
+// property before resolving doesn't include them.
+template<typename Function>
+struct Deferred
+{
+    Function function;
+};
+
+template<typename Function>
+Deferred<std::decay_t<Function>> deferred(Function&& function)
+{
+    return { std::forward<Function>(function) };
+}
+
+template<typename T>
+struct IsDeferred : std::false_type {};
+
+template<typename Function>
+struct IsDeferred<Deferred<Function>> : std::true_type {};
+
+// The result of a deferred function, shared by every copy of the property
+// so it's computed at most once, even when resolving several configurations
+// on different threads.
+template<typename T>
+class DeferredValue
+{
+public:
+    DeferredValue(std::function<T()> function)
+        : _function(std::move(function))
+    { }
+
+    const T& get()
+    {
+        std::call_once(_once, [this]()
+        {
+            _value = _function();
+            _function = nullptr;
+        });
+        return _value;
+    }
+
+private:
+    std::once_flag _once;
+    std::function<T()> _function;
+    T _value{};
+};
+
 struct PropertyBase;
 struct PropertyBag;
 
@@ -139,13 +198,63 @@ struct PropertyBag : public PropertyGroup
 {
     PropertyBag()
         : PropertyGroup(this)
+        , _arena(scopedArena())
+    { }
+
+    // The bookkeeping of the properties, like the tracking of duplicates in
+    // lists, is allocated from the arena, which is released when the last
+    // bag sharing it is destroyed.
+    PropertyBag(std::shared_ptr<std::pmr::memory_resource> arena)
+        : PropertyGroup(this)
+        , _arena(std::move(arena))
     { }
 
     std::vector<PropertyBase*> properties;
+
+    // Estimated heap memory owned by the properties
+    size_t heapSize() const;
+
+    // Replaces deferred values with the results of their functions
+    void evaluateDeferred();
+
+    std::pmr::memory_resource* memoryResource() const
+    {
+        return _arena ? _arena.get() : std::pmr::get_default_resource();
+    }
+
 protected:
+    // Makes bags constructed on this thread while it exists, like the
+    // extensions of a bag, share the given arena.
+    class ArenaScope
+    {
+    public:
+        ArenaScope(std::shared_ptr<std::pmr::memory_resource> arena)
+            : _previous(std::exchange(scopedArena(), std::move(arena)))
+        { }
+
+        ArenaScope(const ArenaScope& other) = delete;
+        ArenaScope& operator=(const ArenaScope& other) = delete;
+
+        ~ArenaScope()
+        {
+            scopedArena() = std::move(_previous);
+        }
+
+    private:
+        std::shared_ptr<std::pmr::memory_resource> _previous;
+    };
+
+    std::shared_ptr<std::pmr::memory_resource> _arena;
 
     friend struct Project;
     friend struct PropertyBase;
+
+private:
+    static std::shared_ptr<std::pmr::memory_resource>& scopedArena()
+    {
+        thread_local std::shared_ptr<std::pmr::memory_resource> arena;
+        return arena;
+    }
 };
 
 struct PropertyBase
@@ -156,8 +265,40 @@ struct PropertyBase
     }
 
     virtual void applyOverlay(const PropertyBase& other) = 0;
+
+    // Estimated heap memory owned by the value
+    virtual size_t heapSize() const
+    {
+        return 0;
+    }
+
+    virtual void evaluateDeferred() = 0;
+
+protected:
+    static std::pmr::memory_resource* memoryResource(PropertyGroup* group)
+    {
+        return group->bag->memoryResource();
+    }
 };
 
+inline void PropertyBag::evaluateDeferred()
+{
+    for(auto property : properties)
+    {
+        property->evaluateDeferred();
+    }
+}
+
+inline size_t PropertyBag::heapSize() const
+{
+    size_t size = memory::allocationSize(properties.capacity() * sizeof(PropertyBase*));
+    for(auto property : properties)
+    {
+        size += property->heapSize();
+    }
+    return size;
+}
+
 template<typename ValueType>
 struct Property : public PropertyBase
 {
@@ -168,7 +309,15 @@ struct Property : public PropertyBase
     template<typename U>
     Property& operator =(U&& v)
     {
-        _value = std::forward<U>(v);
+        if constexpr (IsDeferred<std::decay_t<U>>::value)
+        {
+            _deferred = std::make_shared<DeferredValue<ValueType>>(std::forward<U>(v).function);
+        }
+        else
+        {
+            _value = std::forward<U>(v);
+            _deferred.reset();
+        }
         _set = true;
         return *this;
     }
@@ -182,6 +331,20 @@ struct Property : public PropertyBase
     {
         return _value;
     }
+
+    size_t heapSize() const override
+    {
+        return memory::heapSize(_value);
+    }
+
+    void evaluateDeferred() override
+    {
+        if(_deferred)
+        {
+            _value = _deferred->get();
+            _deferred.reset();
+        }
+    }
   
 private:
     void applyOverlay(const PropertyBase& other)
@@ -190,11 +353,13 @@ private:
         if(otherProperty._set)
         {
             _value = otherProperty._value;
+            _deferred = otherProperty._deferred;
         }
     }
 
     ValueType _value{};
     bool _set = false;
+    std::shared_ptr<DeferredValue<ValueType>> _deferred;
 };
 
 template<typename ValueType>
@@ -203,7 +368,7 @@ struct ListProperty : public PropertyBase
     ListProperty(PropertyGroup* group, bool allowDuplicates = false)
         : PropertyBase(group)
         , _allowDuplicates(allowDuplicates)
-        , _duplicateTracker(0, IndexedValueHash(_value), IndexedValueEquals(_value))
+        , _duplicateTracker(0, IndexedValueHash(_value), IndexedValueEquals(_value), memoryResource(group))
     { }
 
     ListProperty(const ListProperty& other) = delete;
@@ -214,7 +379,14 @@ struct ListProperty : public PropertyBase
     template<typename T>
     ListProperty& operator =(T other)
     {
-        if(_allowDuplicates)
+        _deferred.clear();
+        if constexpr (IsDeferred<T>::value)
+        {
+            _value.clear();
+            _duplicateTracker.clear();
+            *this += std::move(other);
+        }
+        else if(_allowDuplicates)
         {
             _value = std::move(other);
         }
@@ -243,6 +415,30 @@ struct ListProperty : public PropertyBase
         return *this;
     }
 
+    // The function may return a single value or a container of values. They
+    // are added where the deferred value was, once it's evaluated.
+    template<typename Function>
+    ListProperty& operator +=(Deferred<Function> other) {
+        _deferred.push_back({ _value.size(), std::make_shared<DeferredValue<std::vector<ValueType>>>([function = std::move(other.function)]()
+        {
+            auto result = function();
+            if constexpr (std::is_convertible_v<decltype(result), ValueType>)
+            {
+                return std::vector<ValueType>{ ValueType(std::move(result)) };
+            }
+            else
+            {
+                std::vector<ValueType> values;
+                for(auto& value : result)
+                {
+                    values.push_back(ValueType(std::move(value)));
+                }
+                return values;
+            }
+        }) });
+        return *this;
+    }
+
     template<typename T>
     ListProperty& operator +=(std::initializer_list<T> other) {
         _value.reserve(_value.size() + other.size());
@@ -283,6 +479,44 @@ struct ListProperty : public PropertyBase
         return _value;
     }
 
+    size_t heapSize() const override
+    {
+        return memory::heapSize(_value) + memory::hashTableSize(_duplicateTracker.size(), _duplicateTracker.bucket_count(), sizeof(int)) +
+               memory::allocationSize(_deferred.capacity() * sizeof(DeferredEntry));
+    }
+
+    void evaluateDeferred() override
+    {
+        if(_deferred.empty())
+        {
+            return;
+        }
+
+        auto deferred = std::move(_deferred);
+        _deferred.clear();
+        auto values = std::move(_value);
+        _value.clear();
+        _duplicateTracker.clear();
+
+        size_t next = 0;
+        auto addDeferred = [&](size_t position)
+        {
+            for(; next < deferred.size() && deferred[next].first == position; ++next)
+            {
+                for(auto& value : deferred[next].second->get())
+                {
+                    *this += value;
+                }
+            }
+        };
+        for(size_t i = 0; i < values.size(); ++i)
+        {
+            addDeferred(i);
+            *this += std::move(values[i]);
+        }
+        addDeferred(values.size());
+    }
+
 private:
     struct IndexedValueEquals
     {
@@ -329,13 +563,26 @@ private:
     {
         auto& otherListProperty = static_cast<const ListProperty&>(other);
         _value.reserve(_value.size() + otherListProperty.value().size());
-        for(auto& e : otherListProperty)
+        size_t next = 0;
+        for(size_t i = 0; i < otherListProperty._value.size(); ++i)
+        {
+            for(; next < otherListProperty._deferred.size() && otherListProperty._deferred[next].first == i; ++next)
+            {
+                _deferred.push_back({ _value.size(), otherListProperty._deferred[next].second });
+            }
+            *this += otherListProperty._value[i];
+        }
+        for(; next < otherListProperty._deferred.size(); ++next)
         {
-            *this += e;
+            _deferred.push_back({ _value.size(), otherListProperty._deferred[next].second });
         }
     }
 
+    // Deferred values with the number of values preceding them
+    using DeferredEntry = std::pair<size_t, std::shared_ptr<DeferredValue<std::vector<ValueType>>>>;
+
     bool _allowDuplicates = false;
     std::vector<ValueType> _value{};
-    std::unordered_set<int, IndexedValueHash, IndexedValueEquals> _duplicateTracker;
+    std::vector<DeferredEntry> _deferred;
+    std::pmr::unordered_set<int, IndexedValueHash, IndexedValueEquals> _duplicateTracker;
 };
\ No newline at end of file
@@ -19,6 +19,8 @@ struct StringId
     operator const char*() const;
     operator std::string_view() const;
     static size_t getStorageSize();
+    // Estimated heap memory used by all interned strings
+    static size_t getStorageBytes();
 
 private:
     const char* _cstr;
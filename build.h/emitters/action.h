@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+#include "core/emitter.h"
+#include "util/cli.h"
+
+// Runs a single callable action. This is how build files for external tools
+// perform commands created with commands::callable.
+class ActionRunner : public Emitter
+{
+public:
+    static ActionRunner instance;
+
+    cli::StringArgument actionId{arguments, "id", "Id of the callable action to run."};
+    cli::StringArgument actionVersion{arguments, "version", "Expected version of the action. Fails if the generator has a different version."};
+
+    ActionRunner();
+
+    virtual void emit(Environment& env) override;
+};
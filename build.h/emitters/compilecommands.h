@@ -18,6 +18,7 @@
 #include "modules/postprocess.h"
 #include "modules/toolchain.h"
 #include "toolchains/detected.h"
+#include "util/cli.h"
 #include "util/process.h"
 #include "util/file.h"
 #include "util/string.h"
@@ -27,10 +28,12 @@ class CompileCommands : public Emitter
 public:
     static CompileCommands instance;
 
+    cli::StringArgument selectedConfig{arguments, "config", "Only emit commands for the specified configuration."};
+
     CompileCommands();
 
     virtual void emit(Environment& env) override;
 
 private:
-    static void emitCommands(std::ostream& stream, const std::filesystem::path& root, Project& project, StringId config, bool first);
+    static std::string emitCommands(const std::filesystem::path& root, Project& project, StringId config);
 };
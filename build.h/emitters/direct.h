@@ -6,10 +6,13 @@
 #include <fstream>
 #include <future>
 #include <iostream>
+#include <memory_resource>
+#include <optional>
 #include <set>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "core/emitter.h"
@@ -17,14 +20,17 @@
 #include "core/stringid.h"
 #include "modules/command.h"
 #include "modules/postprocess.h"
+#include "modules/test.h"
 #include "modules/toolchain.h"
 #include "toolchains/detected.h"
 #include "util/cli.h"
 #include "util/file.h"
+#include "util/memory.h"
 #include "util/process.h"
 #include "util/string.h"
 
 struct PendingCommand;
+class EventStream;
 
 class DirectBuilder : public Emitter
 {
@@ -32,13 +38,33 @@ public:
     static DirectBuilder instance;
 
     cli::StringArgument selectedConfig{arguments, "config", "Specify a configuration to build."};
+    cli::StringArgument selectedTargets{arguments, "targets", "Comma separated list of projects to build. Projects they link to are built as well."};
+    cli::FlagOrStringArgument stats{arguments, "stats", "Print the actions using the most time, memory, I/O and context switches, from the build history. The value is the number of actions listed per metric, 10 if omitted.", "10"};
+    cli::BoolArgument memstats{arguments, "memstats", "Print estimated memory used by strings, projects, settings, commands, the build graph and caches."};
+    cli::StringArgument jobs{arguments, "jobs", "Number of commands to run concurrently. Defaults to the CPUs available to the process, respecting affinity and container quotas.", {}, "j"};
+    cli::StringArgument maxLoad{arguments, "max-load", "Don't start new commands while the load average is above this, unless nothing else is running.", {}, "l"};
+    cli::StringArgument eventsTarget{arguments, "events", "Write build events as newline delimited JSON to a file, \"fd:<n>\" or \"unix:<socket path>\"."};
+    cli::BoolArgument runTests{arguments, "test", "Run the tests among the built projects after linking them. Tests that passed are only run again when they change."};
+    cli::StringArgument testShard{arguments, "test-shard", "Only run a part of the tests, given as <index>/<count> with the index counted from 0, to split them between machines."};
 
     DirectBuilder();
 
     virtual void emit(Environment& env) override;
 
+    // Parses a --test-shard value, "<index>/<count>" with the index counted from 0
+    static std::pair<size_t, size_t> parseTestShard(const std::string& shardStr);
+
+    // Builds the given projects for one configuration, without checking
+    // whether the generator itself has changed. Returns the number of tests
+    // that were run and didn't pass.
+    size_t buildConfig(Environment& env, const std::vector<Project*>& projects, StringId config, size_t slots, std::optional<double> loadLimit, std::optional<std::pair<size_t, size_t>> shard, EventStream* events);
+
 private:
-    static void collectCommands(std::vector<PendingCommand>& pendingCommands, const std::filesystem::path& root, Project& project, StringId config);
-    static size_t runCommands(const std::vector<PendingCommand*>& commands, size_t maxConcurrentCommands);
-    static std::vector<PendingCommand*> processCommands(std::vector<PendingCommand>& pendingCommands);
+    static void collectCommands(std::pmr::vector<PendingCommand>& pendingCommands, const std::filesystem::path& root, const std::filesystem::path& sharedRoot, Project& project, StringId config, memory::Report* report = nullptr);
+    size_t maxConcurrentCommands();
+    size_t statsCount();
+    std::optional<double> maxLoadAverage();
+    void selectTests(std::pmr::vector<PendingCommand>& pendingCommands, std::optional<std::pair<size_t, size_t>> shard);
+    static size_t runCommands(const std::vector<PendingCommand*>& commands, size_t maxConcurrentCommands, std::optional<double> maxLoadAverage, EventStream* events);
+    static std::vector<PendingCommand*> processCommands(std::pmr::vector<PendingCommand>& pendingCommands);
 };
@@ -5,6 +5,8 @@
 #include <iostream>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "core/emitter.h"
@@ -14,6 +16,7 @@
 #include "modules/postprocess.h"
 #include "modules/toolchain.h"
 #include "toolchains/detected.h"
+#include "util/file.h"
 
 class NinjaEmitter : public Emitter
 {
@@ -25,5 +28,5 @@ public:
     virtual void emit(Environment& env) override;
 
 private:
-    static std::string emitProject(const std::filesystem::path& root, Project& project, StringId config, bool generator);
+    static std::string emitProject(const std::filesystem::path& root, Project& project, StringId config, bool generator, std::string_view actionCommand, std::unordered_set<std::string>& emittedOutputs, file::WriteBatch& batch);
 };
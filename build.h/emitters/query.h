@@ -12,10 +12,13 @@ public:
 
     cli::BoolArgument listProjects{arguments, "projects", "List all defined projects."};
     cli::BoolArgument listConfigs{arguments, "configs", "List all defined configurations."};
+    cli::StringArgument affectedFiles{arguments, "affected", "List the projects that need rebuilding when the given comma separated files change. Reads a file list from stdin if '-'."};
+    cli::StringArgument selectedConfig{arguments, "config", "Specify a configuration to query affected projects for."};
 
     Query();
 
     virtual void emit(Environment& env) override;
     void emitProjects(Environment& env);
     void emitConfigs(Environment& env);
+    void emitAffected(Environment& env);
 };
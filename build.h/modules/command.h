@@ -1,10 +1,112 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "core/property.h"
+#include "core/stringid.h"
+
+// A simple file operation that a builder may perform itself instead of
+// starting a shell for the equivalent command line.
+struct BuiltinStep
+{
+    enum Kind
+    {
+        Copy,
+        Move,
+        Mkdir,
+        Touch,
+    };
+
+    Kind kind;
+    // Source of Copy and Move
+    std::filesystem::path from;
+    // Destination of Copy and Move, directory of Mkdir, file of Touch
+    std::filesystem::path to;
+
+    bool operator ==(const BuiltinStep& other) const
+    {
+        return kind == other.kind && from == other.from && to == other.to;
+    }
+};
+
+template<>
+struct memory::HeapSize<BuiltinStep>
+{
+    static size_t get(const BuiltinStep& step)
+    {
+        return memory::heapSize(step.from) + memory::heapSize(step.to);
+    }
+};
+
+// C++ code run as a build action, created with commands::callable. Builders
+// run it inside the generator process, while build files for other tools
+// invoke the generator with the "action" action and the id of the callable.
+struct CallableAction
+{
+    using Function = std::function<void(const std::vector<std::filesystem::path>& inputs, const std::vector<std::filesystem::path>& outputs)>;
+
+    // Identifies the action across generator invocations. Must be unique.
+    std::string id;
+    // Outputs are rebuilt when this changes, like they would if a command
+    // line changed. Bump it when the behavior of the function changes.
+    std::string version;
+    std::vector<std::filesystem::path> inputs;
+    std::vector<std::filesystem::path> outputs;
+    // Reports failure by throwing.
+    Function function;
+};
+
+struct CallableActions
+{
+    static void install(std::shared_ptr<const CallableAction> action)
+    {
+        auto& storage = getStorage();
+        std::scoped_lock lock(storage.mutex);
+        if(!storage.actions.emplace(action->id, action).second)
+        {
+            throw std::runtime_error("Callable action '" + action->id + "' has already been defined.");
+        }
+    }
+
+    static const CallableAction* find(std::string_view id)
+    {
+        auto& storage = getStorage();
+        std::scoped_lock lock(storage.mutex);
+        auto it = storage.actions.find(std::string(id));
+        return it != storage.actions.end() ? it->second.get() : nullptr;
+    }
+
+    // Forgets all actions, which must be done before unloading the code they call.
+    static void clear()
+    {
+        auto& storage = getStorage();
+        std::scoped_lock lock(storage.mutex);
+        storage.actions.clear();
+    }
+
+private:
+    // Actions are installed while configuring, which may be done from
+    // several threads at once.
+    struct Storage
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<const CallableAction>> actions;
+    };
+
+    static Storage& getStorage()
+    {
+        static Storage storage;
+        return storage;
+    }
+};
 
 struct CommandEntry
 {
@@ -14,10 +116,36 @@ struct CommandEntry
     std::filesystem::path workingDirectory;
     std::filesystem::path depFile;
     std::string description;
+    // If not empty, performing these steps in order is equivalent to running
+    // command. Emitters that can't perform them use command instead.
+    std::vector<BuiltinStep> builtins;
+    // If set, this command is performed by calling C++ code, and command is
+    // only a signature used to detect changes.
+    std::shared_ptr<const CallableAction> callable;
+    // Shared start of the command line, e.g. the compiler and flags common to
+    // all files in a project. The full command line is this followed by
+    // command, but it's interned once instead of copied into every command.
+    StringId commandPrefix;
+    // If set, the command may leave its outputs untouched when they're already
+    // correct, and commands using them only need to run if they were written.
+    bool restat = false;
+    // Seconds the command may run before it's killed and fails, or 0 for no
+    // limit. Only enforced by builders running commands themselves.
+    double timeout = 0.0;
+
+    std::string commandLine() const
+    {
+        return std::string(std::string_view(commandPrefix)) + command;
+    }
 
     bool operator ==(const CommandEntry& other) const
     {
-        return command == other.command &&
+        return commandPrefix.cstr() == other.commandPrefix.cstr() &&
+               command == other.command &&
+               builtins == other.builtins &&
+               callable == other.callable &&
+               restat == other.restat &&
+               timeout == other.timeout &&
                outputs == other.outputs &&
                inputs == other.inputs &&
                workingDirectory == other.workingDirectory &&
@@ -25,12 +153,29 @@ struct CommandEntry
     }
 };
 
+// Callables are shared between commands and not counted here.
+template<>
+struct memory::HeapSize<CommandEntry>
+{
+    static size_t get(const CommandEntry& command)
+    {
+        return memory::heapSize(command.command) +
+               memory::heapSize(command.inputs) +
+               memory::heapSize(command.outputs) +
+               memory::heapSize(command.workingDirectory) +
+               memory::heapSize(command.depFile) +
+               memory::heapSize(command.description) +
+               memory::heapSize(command.builtins);
+    }
+};
+
 template<>
 struct std::hash<CommandEntry>
 {
     std::size_t operator()(CommandEntry const& command) const
     {
         std::size_t h = std::hash<std::string>{}(command.command);
+        h = h ^ (std::hash<StringId>{}(command.commandPrefix) << 1);
         for(auto& output : command.outputs)
         {
             h = h ^ (std::filesystem::hash_value(output) << 1);
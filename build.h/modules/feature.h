@@ -17,5 +17,7 @@ inline Feature Exceptions{"Exceptions"};
 inline Feature Optimize{"Optimize"};
 inline Feature OptimizeSize{"OptimizeSize"};
 inline Feature MacOSBundle{"MacOSBundle"};
+// Place objects by compile command so identical compiles in different projects are shared
+inline Feature SharedObjects{"SharedObjects"};
 
 }
@@ -4,6 +4,7 @@
 
 #include "core/stringid.h"
 #include "modules/language.h"
+#include "util/memory.h"
 
 struct SourceFile
 {
@@ -35,3 +36,12 @@ struct std::hash<SourceFile>
         return std::filesystem::hash_value(sourceFile.path);
     }
 };
+
+template<>
+struct memory::HeapSize<SourceFile>
+{
+    static size_t get(const SourceFile& sourceFile)
+    {
+        return memory::heapSize(sourceFile.path);
+    }
+};
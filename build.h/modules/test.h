@@ -0,0 +1,24 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include "core/property.h"
+
+namespace extensions
+{
+    // Makes an executable project a test, which the build emitter runs after
+    // linking it when given --test. A test passes if it exits with 0. It's only
+    // run again when the executable, the data files or the settings below change.
+    struct Test : public PropertyBag
+    {
+        Property<bool> enabled{this};
+        ListProperty<std::string> arguments{this, true};
+        // Files read by the test, so changing them runs it again
+        ListProperty<std::filesystem::path> data{this};
+        // Defaults to the directory the build was started in
+        Property<std::filesystem::path> workingDirectory{this};
+        // Seconds the test may run before it's killed and fails, or 0 for no limit
+        Property<double> timeout{this};
+    };
+}
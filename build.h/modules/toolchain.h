@@ -1,7 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <filesystem>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "core/project.h"
@@ -22,6 +24,13 @@ struct Toolchains
         return getToolchains();
     }
 
+    // Drops toolchains installed after the first count, e.g. by an unloaded module.
+    static void truncate(size_t count)
+    {
+        auto& toolchains = getToolchains();
+        toolchains.resize(std::min(count, toolchains.size()));
+    }
+
 private:
     static std::vector<const ToolchainProvider*>& getToolchains()
     {
@@ -43,4 +52,11 @@ struct ToolchainProvider
     }
 
     virtual std::vector<std::filesystem::path> process(Project& project, ProjectSettings& resolvedSettings, StringId config, const std::filesystem::path& workingDir) const = 0;
+
+protected:
+    // Where the object compiled from input is placed. With feature::SharedObjects
+    // it's keyed on a hash of the compile command rather than the project name,
+    // so projects compiling a source identically share a single object. When
+    // the shared data directory is set, configurations share it as well.
+    static std::filesystem::path getObjectPath(Project& project, ProjectSettings& resolvedSettings, const std::filesystem::path& input, std::string_view commandPrefix, std::string_view inputStr);
 };
@@ -0,0 +1,38 @@
+#include "emitters/action.h"
+#include "modules/command.h"
+
+ActionRunner::ActionRunner()
+    : Emitter("action", "Run a callable build action. Used by generated build files.")
+{
+}
+
+void ActionRunner::emit(Environment& env)
+{
+    if(!actionId)
+    {
+        throw cli::argument_error("No action id specified.");
+    }
+
+    auto action = CallableActions::find(*actionId);
+    if(!action)
+    {
+        throw std::runtime_error("Callable action '" + std::string(*actionId) + "' has not been defined in build configuration.");
+    }
+
+    if(actionVersion && std::string_view(*actionVersion) != action->version)
+    {
+        throw std::runtime_error("Callable action '" + action->id + "' is version '" + action->version + "' but version '" + std::string(*actionVersion) + "' was requested. The generator is out of date.");
+    }
+
+    for(auto& output : action->outputs)
+    {
+        if(output.has_parent_path())
+        {
+            std::filesystem::create_directories(output.parent_path());
+        }
+    }
+
+    action->function(action->inputs, action->outputs);
+}
+
+ActionRunner ActionRunner::instance;
@@ -1,5 +1,8 @@
 #include "emitters/direct.h"
+#include "buildlog.h"
 #include "dependencyparser.h"
+#include "eventstream.h"
+#include "util/profile.h"
 
 struct TimeCache
 {
@@ -17,32 +20,165 @@ public:
         _times.insert(std::make_pair(path, std::make_pair(time, errorCode)));
         return time;
     }
+
+    void invalidate(StringId path)
+    {
+        _times.erase(path);
+    }
+
+    size_t size() const
+    {
+        return _times.size();
+    }
+
+    size_t heapSize() const
+    {
+        return memory::heapSize(_times);
+    }
 private:        
     std::unordered_map<StringId, std::pair<std::filesystem::file_time_type, std::error_code>> _times;
 };
 
+// Kept for the whole process, so a build configuration reloaded by the hot
+// reload host doesn't stat everything again. Outputs are invalidated as the
+// commands writing them finish.
+static TimeCache& statCache()
+{
+    static TimeCache timeCache;
+    return timeCache;
+}
+
+// Build logs are likewise only read once per process.
+static BuildLog& buildLogFor(const std::filesystem::path& path)
+{
+    static std::map<std::filesystem::path, BuildLog> buildLogs;
+    auto it = buildLogs.find(path);
+    if(it == buildLogs.end())
+    {
+        it = buildLogs.emplace(path, BuildLog(path)).first;
+    }
+    return it->second;
+}
+
+// The command graph is rebuilt for every configuration, so its nodes and
+// their lists are allocated from an arena released in one go once the
+// configuration is built. Only the thread running the build modifies it.
+struct PendingCommand
+{
+    std::pmr::vector<StringId> inputs;
+    std::pmr::vector<StringId> outputs;
+    StringId depFile;
+    std::string workingDirectory;
+    // The command line is only assembled when the command is run
+    StringId commandPrefix;
+    std::string commandString;
+    std::string desciption;
+    std::vector<BuiltinStep> builtins;
+    std::shared_ptr<const CallableAction> callable;
+    bool restat = false;
+    double timeout = 0.0;
+    // Runs a test, whose output is a stamp written when it passes
+    bool test = false;
+    bool dirty = false;
+    // Dirty only because dependencies are, which may turn out to leave their
+    // outputs untouched
+    bool dirtyFromDependencies = false;
+    // Whether running the command wrote its outputs
+    bool changed = false;
+    std::pmr::vector<std::filesystem::file_time_type> outputTimes;
+    int depth = 0;
+    std::pmr::vector<PendingCommand*> dependencies;
+    std::future<process::ProcessResult> result;
+    std::optional<process::ResourceUsage> usage;
+    bool failed = false;
+    // Order in which the command was started, as reported in events
+    size_t index = 0;
+};
+
+template<>
+struct memory::HeapSize<PendingCommand>
+{
+    // Dependencies are counted as edges of the graph instead
+    static size_t get(const PendingCommand& command)
+    {
+        return memory::heapSize(command.inputs) +
+               memory::heapSize(command.outputs) +
+               memory::heapSize(command.workingDirectory) +
+               memory::heapSize(command.commandString) +
+               memory::heapSize(command.desciption) +
+               memory::heapSize(command.builtins) +
+               memory::heapSize(command.outputTimes);
+    }
+};
+
+// Touched when a restat command has run, since its outputs may be left older
+// than its inputs.
+static StringId restatStamp(const PendingCommand& command)
+{
+    return std::string(command.outputs.front().cstr()) + ".restat";
+}
+
 DirectBuilder::DirectBuilder()
     : Emitter("build", "Build output binaries.")
 { }
 
 void DirectBuilder::emit(Environment& env)
 {
+    size_t slots = maxConcurrentCommands();
+    auto loadLimit = maxLoadAverage();
+    std::optional<std::pair<size_t, size_t>> shard;
+    if(testShard)
     {
+        shard = parseTestShard(std::string(*testShard));
+    }
+
+    std::unique_ptr<EventStream> events;
+    if(eventsTarget)
+    {
+        events = std::make_unique<EventStream>(std::string(*eventsTarget));
+    }
+
+    {
+        profile::Scope scope("Check generator");
         auto [generator, buildOutput] = createGeneratorProject(env, *targetPath);
 
-        std::vector<PendingCommand> pendingCommands;
-        collectCommands(pendingCommands, *targetPath, *generator, "");
+        // The core library must be processed before the generator links to it
+        std::pmr::monotonic_buffer_resource arena;
+        std::pmr::vector<PendingCommand> pendingCommands(&arena);
+        for(auto project : env.collectProjects({ generator }))
+        {
+            collectCommands(pendingCommands, *targetPath, {}, *project, "");
+        }
         auto commands = processCommands(pendingCommands);
 
         if(!commands.empty())
         {
+            if(events)
+            {
+                events->post(events->event("graph_ready").field("generator", true).field("total", pendingCommands.size()).field("dirty", commands.size()));
+            }
+
             std::cout << "Generator has changed. Rebuilding...";
-            size_t completedCommands = runCommands(commands, 1);
+            size_t completedCommands = runCommands(commands, slots, loadLimit, events.get());
+
+            if(events)
+            {
+                events->post(events->event("build_finished").field("generator", true).field("success", completedCommands == commands.size()));
+            }
 
             int exitCode = 0;
             if(completedCommands == commands.size())
             {
+                if(!env.generatorModule.empty())
+                {
+                    std::cout << "Reloading build configuration.\n\n" << std::flush;
+                    env.reloadRequested = true;
+                    return;
+                }
+
                 std::cout << "Restarting build.\n\n" << std::flush;
+                // The restarted generator appends to the same stream
+                events.reset();
                 std::string argumentString;
                 for(auto& arg : env.cliContext.allArguments)
                 {
@@ -60,6 +196,27 @@ void DirectBuilder::emit(Environment& env)
     auto projects = env.collectProjects();
     auto configs = env.collectConfigs();
 
+    if(selectedTargets)
+    {
+        std::vector<Project*> targets;
+        for(auto name : str::splitAll(*selectedTargets, ','))
+        {
+            name = str::trim(name);
+            if(name.empty())
+            {
+                continue;
+            }
+
+            auto project = env.findProject(name);
+            if(!project || !project->type)
+            {
+                throw std::runtime_error("Selected target '" + std::string(name) + "' has not been defined in build configuration.");
+            }
+            targets.push_back(project);
+        }
+        projects = env.collectProjects(targets);
+    }
+
     if(selectedConfig)
     {
         if(std::find(configs.begin(), configs.end(), *selectedConfig) == configs.end())
@@ -68,64 +225,166 @@ void DirectBuilder::emit(Environment& env)
         }
     }
 
-    std::vector<PendingCommand> pendingCommands;
+    size_t failedTests = 0;
     for(auto config : configs)
     {
         if(selectedConfig && config != *selectedConfig)
         {
             continue;
         }
-        
-        std::string configPrefix = config.empty() ? "" : std::string(config) + ": ";
+        failedTests += buildConfig(env, projects, config, slots, loadLimit, shard, events.get());
+    }
 
-        pendingCommands.clear();
+    if(failedTests > 0)
+    {
+        throw std::runtime_error(std::to_string(failedTests) + (failedTests == 1 ? " test" : " tests") + " did not pass.");
+    }
+}
 
+size_t DirectBuilder::buildConfig(Environment& env, const std::vector<Project*>& projects, StringId config, size_t slots, std::optional<double> loadLimit, std::optional<std::pair<size_t, size_t>> shard, EventStream* events)
+{
+    size_t failedTests = 0;
+    std::string configPrefix = config.empty() ? "" : std::string(config) + ": ";
+    // Checked before building rather than after
+    size_t reportCount = stats ? statsCount() : 0;
+
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<PendingCommand> pendingCommands(&arena);
+    std::optional<memory::Report> report;
+    if(memstats)
+    {
+        report.emplace();
+    }
+
+    auto configRoot = configDataDir(*targetPath, config);
+    auto& buildLog = buildLogFor(configRoot / ".buildlog");
+
+    {
+        profile::Scope scope("Collect commands", config);
         for(auto project : projects)
         {
-            // TODO: This has already been processed separately above, and should
+            // TODO: This has already been processed separately by emit, and should
             // probably not even be part of the main list.
-            if(project->name == "_generator")
+            if(isGeneratorProject(*project))
             {
                 continue;
             }
-            collectCommands(pendingCommands, *targetPath / config.cstr(), *project, config);
+            collectCommands(pendingCommands, configRoot, sharedDataDir(*targetPath), *project, config, report ? &*report : nullptr);
         }
-        auto commands = processCommands(pendingCommands);
+        selectTests(pendingCommands, shard);
+    }
+    auto commands = processCommands(pendingCommands);
+
+    if(events)
+    {
+        events->post(events->event("graph_ready").field("config", std::string_view(config)).field("total", pendingCommands.size()).field("dirty", commands.size()));
+    }
 
-        if(commands.empty())
+    if(commands.empty())
+    {
+        std::cout << configPrefix + "Nothing to do. (Everything up to date.)\n" << std::flush;
+    }
+    else
+    {
+        std::cout << "Building using " << slots << " concurrent tasks";
+        if(loadLimit)
         {
-            std::cout << configPrefix + "Nothing to do. (Everything up to date.)\n" << std::flush;
+            std::cout << " while the load average is below " << *loadLimit;
         }
-        else
+        std::cout << ".";
+        size_t completedCommands = runCommands(commands, slots, loadLimit, events);
+
+        std::cout << "\n" << configPrefix + std::to_string(completedCommands) << " of " << commands.size() << " targets rebuilt.\n" << std::flush;
+
+        size_t testCount = 0;
+        size_t passedCount = 0;
+        std::string failures;
+        for(auto command : commands)
+        {
+            if(!command->test)
+            {
+                continue;
+            }
+            ++testCount;
+            if(command->failed)
+            {
+                failures += "  " + command->desciption + "\n";
+            }
+            else if(command->usage)
+            {
+                ++passedCount;
+            }
+        }
+        if(testCount > 0)
         {
-            size_t maxConcurrentCommands = std::max((size_t)1, (size_t)std::thread::hardware_concurrency());
-            std::cout << "Building using " << maxConcurrentCommands << " concurrent tasks.";
-            size_t completedCommands = runCommands(commands, maxConcurrentCommands);
+            std::cout << configPrefix + std::to_string(passedCount) << " of " << testCount << " tests passed.\n" << failures << std::flush;
+            failedTests = testCount - passedCount;
+        }
 
-            std::cout << "\n" << configPrefix + std::to_string(completedCommands) << " of " << commands.size() << " targets rebuilt.\n" << std::flush;
+        profile::Scope scope("Write build log");
+        for(auto command : commands)
+        {
+            if(command->usage && !command->outputs.empty())
+            {
+                buildLog.record(command->outputs.front().cstr(), command->desciption, *command->usage);
+            }
+        }
+        buildLog.write();
+
+        // TODO: Error exit code on failure
+    }
+
+    if(events)
+    {
+        bool success = std::none_of(commands.begin(), commands.end(), [](auto command) { return command->failed || command->dirty; });
+        events->post(events->event("build_finished").field("config", std::string_view(config)).field("success", success));
+    }
 
-            // TODO: Error exit code on failure
+    if(report)
+    {
+        report->add("Interned strings", StringId::getStorageSize(), StringId::getStorageBytes());
+        for(auto project : env.collectProjects())
+        {
+            report->add("Projects", 1, memory::allocationSize(sizeof(Project)) + memory::heapSize(project->name) + project->ProjectSettings::heapSize());
+            for(auto& [selector, settings] : project->configs)
+            {
+                report->add("Config settings", 1, memory::nodeSize(sizeof(std::pair<const ConfigSelector, ProjectSettings>), 3) + settings.heapSize());
+            }
+        }
+        size_t edges = 0;
+        size_t edgeBytes = 0;
+        size_t nodeBytes = memory::allocationSize(pendingCommands.capacity() * sizeof(PendingCommand));
+        for(auto& command : pendingCommands)
+        {
+            nodeBytes += memory::heapSize(command);
+            edges += command.dependencies.size();
+            edgeBytes += memory::allocationSize(command.dependencies.capacity() * sizeof(PendingCommand*));
         }
+        report->add("Graph nodes", pendingCommands.size(), nodeBytes);
+        report->add("Graph edges", edges, edgeBytes);
+        report->add("Stat cache", statCache().size(), statCache().heapSize());
+        report->add("Build log", buildLog.size(), buildLog.heapSize());
+
+        std::cout << "\n" << configPrefix + "Estimated memory usage:\n";
+        report->print(std::cout);
+        std::cout << std::flush;
     }
-}
 
-struct PendingCommand
-{
-    std::vector<StringId> inputs;
-    std::vector<StringId> outputs;
-    StringId depFile;
-    std::string commandString;
-    std::string desciption;
-    bool dirty = false;
-    int depth = 0;
-    std::vector<PendingCommand*> dependencies;
-    std::future<process::ProcessResult> result;
-};
+    if(stats)
+    {
+        std::cout << "\n" << configPrefix + "Resource usage from build history:\n";
+        buildLog.printReport(std::cout, reportCount);
+        std::cout << std::flush;
+    }
 
-void DirectBuilder::collectCommands(std::vector<PendingCommand>& pendingCommands, const std::filesystem::path& root, Project& project, StringId config)
+    return failedTests;
+}
+
+void DirectBuilder::collectCommands(std::pmr::vector<PendingCommand>& pendingCommands, const std::filesystem::path& root, const std::filesystem::path& sharedRoot, Project& project, StringId config, memory::Report* report)
 {
     auto resolved = project.resolve(config, OperatingSystem::current());
     resolved.dataDir = root;
+    resolved.sharedDataDir = sharedRoot;
 
 #if TODO
     {
@@ -164,7 +423,47 @@ void DirectBuilder::collectCommands(std::vector<PendingCommand>& pendingCommands
         toolchain = defaultToolchain;
     }
 
-    auto toolchainOutputs = toolchain->process(project, resolved, config, {});
+    std::vector<std::filesystem::path> toolchainOutputs;
+    {
+        profile::Scope scope("Toolchain processing", project.name);
+        toolchainOutputs = toolchain->process(project, resolved, config, {});
+    }
+
+    // Tests are always collected so their results are remembered, even by
+    // builds that don't run them. The command line only identifies the test
+    // and detects changes; the stamp output is written when it passes.
+    StringId testOutput;
+    auto& test = resolved.ext<extensions::Test>();
+    if(project.type == Executable && test.enabled.value() && !toolchainOutputs.empty())
+    {
+        CommandEntry command;
+        command.command = str::quote(std::filesystem::absolute(toolchainOutputs.front()).string());
+        for(auto& argument : test.arguments)
+        {
+            command.command += " " + str::quote(argument);
+        }
+        command.inputs = { toolchainOutputs.front() };
+        command.inputs.insert(command.inputs.end(), test.data.begin(), test.data.end());
+        command.outputs = { root / "tests" / (project.name + ".passed") };
+        command.workingDirectory = test.workingDirectory;
+        command.timeout = test.timeout;
+        command.description = "Testing " + project.name;
+        testOutput = command.outputs.front().string();
+        resolved.commands += std::move(command);
+    }
+
+    if(report)
+    {
+        size_t commandBytes = memory::heapSize(commands.value());
+        size_t commandLineBytes = 0;
+        for(auto& command : commands)
+        {
+            commandLineBytes += command.command.size();
+        }
+        report->add("Resolved settings", 1, sizeof(resolved) + resolved.heapSize() - commandBytes);
+        report->add("Commands", commands.value().size(), commandBytes);
+        report->add("Command line text", commands.value().size(), commandLineBytes);
+    }
 
     std::string prologue;
     if(OperatingSystem::current() == Windows)
@@ -174,10 +473,10 @@ void DirectBuilder::collectCommands(std::vector<PendingCommand>& pendingCommands
     prologue += "cd \"$cwd\" && ";
 
     auto cmdFilePath = root / (project.name + ".cmdlines");
-    auto cmdData = file::read(cmdFilePath);
+    file::MappedFile cmdData(cmdFilePath);
     std::unordered_map<StringId, std::string_view> cmdLines;
 
-    auto cmdDataView = std::string_view(cmdData);
+    auto cmdDataView = cmdData.view();
     while(!cmdDataView.empty())
     {
         std::string_view line;
@@ -185,9 +484,17 @@ void DirectBuilder::collectCommands(std::vector<PendingCommand>& pendingCommands
         auto [file, cmdLine] = str::split(line, 0);
         cmdLines[file] = cmdLine;
     }
-    std::ofstream cmdFile(cmdFilePath, std::ostream::binary);
 
-    pendingCommands.reserve(pendingCommands.size() + commands.value().size());
+    std::string sharedRootStr = sharedRoot.empty() ? std::string() : (sharedRoot / "").string();
+
+    // The previous command lines are views into the mapped file, so the new
+    // ones are collected and written once all comparisons are done.
+    std::string newCmdData;
+
+    // Not reserved per project, as every reallocation of an arena vector
+    // keeps the old buffer until the build ends. Letting it grow
+    // geometrically bounds that to the size of the final vector.
+    auto arena = pendingCommands.get_allocator().resource();
     for(auto& command : commands)
     {
         std::filesystem::path cwd = command.workingDirectory;
@@ -197,7 +504,7 @@ void DirectBuilder::collectCommands(std::vector<PendingCommand>& pendingCommands
         }
         std::string cwdStr = cwd.string();
 
-        std::vector<StringId> inputStrs;
+        std::pmr::vector<StringId> inputStrs(arena);
         inputStrs.reserve(command.inputs.size());
         for(auto& path : command.inputs)
         {
@@ -205,23 +512,34 @@ void DirectBuilder::collectCommands(std::vector<PendingCommand>& pendingCommands
         }
 
         bool dirty = false;
+        std::string_view prefix = command.commandPrefix;
 
-        std::vector<StringId> outputStrs;
+        std::pmr::vector<StringId> outputStrs(arena);
         outputStrs.reserve(command.outputs.size());
         for(auto& path : command.outputs)
         {
             auto str = path.string();
             auto strId = StringId(str);
             outputStrs.push_back(strId);
-            if(cmdLines[strId] != command.command)
+            // Compared in parts, to not build every full command line
+            auto previous = cmdLines.find(strId);
+            if(previous == cmdLines.end())
+            {
+                // Shared outputs may have been built by another configuration
+                if(sharedRootStr.empty() || !str::startsWith(str, sharedRootStr))
+                {
+                    dirty = true;
+                }
+            }
+            else if(!str::startsWith(previous->second, prefix) || previous->second.substr(prefix.size()) != command.command)
             {
-                // LOG std::cout << "\"" << cmdLines[strId] << "\" vs \"" << command.command << "\"\n";
                 dirty = true;
             }
             
-            cmdFile.write(str.c_str(), str.size()+1);
-            cmdFile.write(command.command.c_str(), command.command.size());
-            cmdFile.write("\n", 1);
+            newCmdData.append(str.c_str(), str.size()+1);
+            newCmdData += prefix;
+            newCmdData += command.command;
+            newCmdData += '\n';
         }
 
         std::string depfileStr;
@@ -230,19 +548,224 @@ void DirectBuilder::collectCommands(std::vector<PendingCommand>& pendingCommands
             depfileStr = command.depFile.string();
         }
 
+        std::vector<BuiltinStep> builtins = command.builtins;
+        for(auto& step : builtins)
+        {
+            if(!step.from.empty() && step.from.is_relative())
+            {
+                step.from = cwd / step.from;
+            }
+            if(step.to.is_relative())
+            {
+                step.to = cwd / step.to;
+            }
+        }
+
+        bool test = outputStrs.size() == 1 && outputStrs.front() == testOutput;
+        if(test && dirty)
+        {
+            // The new command line is recorded below, so a stamp from a
+            // previous version of the test mustn't be taken as a pass.
+            std::error_code ec;
+            std::filesystem::remove(testOutput.cstr(), ec);
+            statCache().invalidate(testOutput);
+        }
         pendingCommands.push_back({
-            inputStrs,
-            outputStrs,
+            std::move(inputStrs),
+            std::move(outputStrs),
             depfileStr,
-            "cd \"" + cwdStr + "\" && " + command.command,
+            cwdStr,
+            command.commandPrefix,
+            command.command,
             command.description,
-            dirty
+            std::move(builtins),
+            command.callable,
+            command.restat,
+            command.timeout,
+            test,
+            dirty,
+            false,
+            false,
+            std::pmr::vector<std::filesystem::file_time_type>(arena),
+            0,
+            std::pmr::vector<PendingCommand*>(arena)
         });
     }
+
+    file::write(cmdFilePath, newCmdData);
+}
+
+size_t DirectBuilder::maxConcurrentCommands()
+{
+    if(!jobs)
+    {
+        return process::availableConcurrency();
+    }
+
+    auto jobsStr = std::string(*jobs);
+    char* end = nullptr;
+    auto count = std::strtoll(jobsStr.c_str(), &end, 10);
+    if(jobsStr.empty() || *end != '\0' || count < 1)
+    {
+        throw cli::argument_error("Invalid job count '" + jobsStr + "'.");
+    }
+    return (size_t)count;
+}
+
+size_t DirectBuilder::statsCount()
+{
+    auto countStr = std::string(*stats);
+    char* end = nullptr;
+    auto count = std::strtoll(countStr.c_str(), &end, 10);
+    if(countStr.empty() || !std::isdigit((unsigned char)countStr[0]) || *end != '\0' || count < 1)
+    {
+        throw cli::argument_error("Invalid stats count '" + countStr + "'.");
+    }
+    return (size_t)count;
+}
+
+std::pair<size_t, size_t> DirectBuilder::parseTestShard(const std::string& shardStr)
+{
+    auto [indexStr, countStr] = str::split(std::string_view(shardStr), '/');
+    char* indexEnd = nullptr;
+    char* countEnd = nullptr;
+    std::string indexCopy(indexStr), countCopy(countStr);
+    auto index = std::strtoll(indexCopy.c_str(), &indexEnd, 10);
+    auto count = std::strtoll(countCopy.c_str(), &countEnd, 10);
+    if(indexCopy.empty() || countCopy.empty() || !std::isdigit((unsigned char)indexCopy[0]) || !std::isdigit((unsigned char)countCopy[0]) || *indexEnd != '\0' || *countEnd != '\0' || index < 0 || count < 1 || index >= count)
+    {
+        throw cli::argument_error("Invalid test shard '" + shardStr + "'. Expected <index>/<count>, with the index counted from 0.");
+    }
+    return { (size_t)index, (size_t)count };
 }
 
-size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands, size_t maxConcurrentCommands)
+// Drops the tests that shouldn't run. Shards take every count:th test in
+// name order, so each machine gets the same number of tests.
+void DirectBuilder::selectTests(std::pmr::vector<PendingCommand>& pendingCommands, std::optional<std::pair<size_t, size_t>> shard)
 {
+    std::vector<StringId> tests;
+    for(auto& command : pendingCommands)
+    {
+        if(command.test)
+        {
+            tests.push_back(command.outputs.front());
+        }
+    }
+    std::sort(tests.begin(), tests.end(), [](StringId a, StringId b) { return std::string_view(a) < std::string_view(b); });
+
+    std::unordered_set<StringId> selected;
+    for(size_t i = 0; runTests && i < tests.size(); ++i)
+    {
+        if(!shard || i % shard->second == shard->first)
+        {
+            selected.insert(tests[i]);
+        }
+    }
+
+    pendingCommands.erase(std::remove_if(pendingCommands.begin(), pendingCommands.end(), [&](const PendingCommand& command)
+    {
+        return command.test && selected.find(command.outputs.front()) == selected.end();
+    }), pendingCommands.end());
+}
+
+std::optional<double> DirectBuilder::maxLoadAverage()
+{
+    if(!maxLoad)
+    {
+        return {};
+    }
+
+    auto loadStr = std::string(*maxLoad);
+    char* end = nullptr;
+    auto load = std::strtod(loadStr.c_str(), &end);
+    if(loadStr.empty() || *end != '\0' || !(load > 0.0))
+    {
+        throw cli::argument_error("Invalid load average '" + loadStr + "'.");
+    }
+    return load;
+}
+
+// Performs builtin steps in process, reporting the result the same way as
+// running the equivalent command line would.
+static process::ProcessResult runBuiltins(const std::vector<BuiltinStep>& steps, file::DirectoryCache& directoryCache)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    process::ProcessResult result;
+    result.exitCode = 0;
+    for(auto& step : steps)
+    {
+        std::error_code ec;
+        std::string operation;
+        switch(step.kind)
+        {
+        case BuiltinStep::Copy:
+            operation = "copy '" + step.from.string() + "' -> '" + step.to.string() + "'";
+            file::copy(step.from, step.to, ec);
+            break;
+        case BuiltinStep::Move:
+            operation = "move '" + step.from.string() + "' -> '" + step.to.string() + "'";
+            std::filesystem::rename(step.from, step.to, ec);
+            if(ec == std::errc::cross_device_link)
+            {
+                file::copy(step.from, step.to, ec);
+                if(!ec)
+                {
+                    std::filesystem::remove(step.from, ec);
+                }
+            }
+            break;
+        case BuiltinStep::Mkdir:
+            operation = "create directory '" + step.to.string() + "'";
+            directoryCache.create(step.to, ec);
+            break;
+        case BuiltinStep::Touch:
+            operation = "touch '" + step.to.string() + "'";
+            file::touch(step.to, ec);
+            break;
+        }
+
+        if(ec)
+        {
+            result.output = "Failed to " + operation + ": " + ec.message();
+            result.exitCode = 1;
+            break;
+        }
+    }
+
+    result.usage.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return result;
+}
+
+// Runs a callable action, reporting exceptions as a failed command would.
+static process::ProcessResult runCallable(const CallableAction& action)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    process::ProcessResult result;
+    result.exitCode = 0;
+    try
+    {
+        action.function(action.inputs, action.outputs);
+    }
+    catch(const std::exception& e)
+    {
+        result.output = "Action '" + action.id + "' failed: " + e.what();
+        result.exitCode = 1;
+    }
+    catch(...)
+    {
+        result.output = "Action '" + action.id + "' failed.";
+        result.exitCode = 1;
+    }
+
+    result.usage.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return result;
+}
+
+size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands, size_t maxConcurrentCommands, std::optional<double> maxLoadAverage, EventStream* events)
+{
+    profile::Scope scope("Run commands");
     size_t count = 0;
     size_t completed = 0;
     size_t firstPending = 0;
@@ -250,6 +773,7 @@ size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands,
     bool halt = false;
     std::mutex doneMutex;
     std::vector<PendingCommand*> doneCommands;
+    file::DirectoryCache directoryCache;
     while((!halt && firstPending < commands.size()) || !runningCommands.empty())
     {
         // TODO: Semaphore of some kind instead of semi-spin lock
@@ -262,6 +786,10 @@ size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands,
             {
                 auto command = *it;
                 command->dirty = false;
+                for(auto& output : command->outputs)
+                {
+                    statCache().invalidate(output);
+                }
 
                 auto result = command->result.get();
                 auto output = str::trim(std::string_view(result.output));
@@ -269,15 +797,62 @@ size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands,
                 {
                     std::cout << "\n" << output;
                 }
-                if(result.exitCode != 0)
+                if(result.timedOut)
                 {
-                    std::cout << "\nCommand returned " + std::to_string(result.exitCode);
-                    halt = true;
+                    std::cout << "\n" << (command->test ? "Test" : "Command") << " timed out after " << command->timeout << " seconds.";
+                }
+                else if(result.exitCode != 0)
+                {
+                    std::cout << "\n" << (command->test ? "Test" : "Command") << " returned " + std::to_string(result.exitCode);
+                }
+
+                if(result.exitCode != 0 || result.timedOut)
+                {
+                    // A failing test doesn't stop the others
+                    command->failed = true;
+                    halt = halt || !command->test;
                 }
                 else
                 {
+                    if(command->test)
+                    {
+                        std::error_code ec;
+                        file::touch(command->outputs.front().cstr(), ec);
+                    }
+                    command->usage = result.usage;
                     ++completed;
                 }
+
+                if(events)
+                {
+                    events->post(events->event("action_finished")
+                        .field("index", command->index)
+                        .field("exit_code", result.exitCode)
+                        .field("timed_out", result.timedOut)
+                        .field("duration", result.usage.wallTime));
+                }
+
+                command->changed = true;
+                if(command->restat && !command->outputs.empty())
+                {
+                    if(result.exitCode == 0)
+                    {
+                        std::error_code ec;
+                        file::touch(restatStamp(*command).cstr(), ec);
+                        statCache().invalidate(restatStamp(*command));
+                    }
+
+                    command->changed = false;
+                    for(size_t i = 0; i < command->outputs.size(); ++i)
+                    {
+                        std::error_code ec;
+                        auto time = std::filesystem::last_write_time(command->outputs[i].cstr(), ec);
+                        if(ec || time != command->outputTimes[i])
+                        {
+                            command->changed = true;
+                        }
+                    }
+                }
                 it = doneCommands.erase(it);
 
                 auto runIt = std::find(runningCommands.begin(), runningCommands.end(), command);
@@ -296,10 +871,22 @@ size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands,
             continue;
         }
 
+        // Like make and ninja, the load limit never stops the first command
+        // so the build can't stall.
+        size_t slots = maxConcurrentCommands;
+        if(maxLoadAverage && !runningCommands.empty())
+        {
+            auto load = process::loadAverage();
+            if(load && *load >= *maxLoadAverage)
+            {
+                slots = runningCommands.size();
+            }
+        }
+
         bool skipped = false;
         for(size_t i = firstPending; i < commands.size(); ++i)
         {
-            if(runningCommands.size() >= maxConcurrentCommands)
+            if(runningCommands.size() >= slots)
             {
                 break;
             }
@@ -323,25 +910,86 @@ size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands,
                     continue;
                 }
 
-                std::cout << "\n["/*"\33[2K\r["*/ << (++count) << "/" << commands.size() << "] " << command->desciption << std::flush;
-                command->result = std::async(std::launch::async, [command, &doneMutex, &doneCommands](){
-                    for(auto& output : command->outputs)
+                // Everything this was waiting for left its outputs untouched
+                if(command->dirtyFromDependencies &&
+                   std::none_of(command->dependencies.begin(), command->dependencies.end(), [](auto dependency) { return dependency->changed; }))
+                {
+                    command->dirty = false;
+                    if(events)
                     {
-                        std::filesystem::path path(output.cstr());
-                        if(path.has_parent_path())
+                        events->post(events->event("action_skipped").field("description", command->desciption));
+                    }
+                }
+                else
+                {
+                    if(command->restat)
+                    {
+                        command->outputTimes.clear();
+                        for(auto& output : command->outputs)
                         {
-                            std::filesystem::create_directories(path.parent_path());
+                            std::error_code ec;
+                            command->outputTimes.push_back(std::filesystem::last_write_time(output.cstr(), ec));
                         }
                     }
 
-                    auto result = process::run(command->commandString + " 2>&1");
+                    // A test is only passed once it has passed this time
+                    if(command->test)
                     {
-                        std::scoped_lock doneLock(doneMutex);
-                        doneCommands.push_back(command);
+                        std::error_code ec;
+                        std::filesystem::remove(command->outputs.front().cstr(), ec);
+                        statCache().invalidate(command->outputs.front());
                     }
-                    return result;
-                });
-                runningCommands.push_back(command);
+
+                    command->index = ++count;
+                    std::cout << "\n["/*"\33[2K\r["*/ << count << "/" << commands.size() << "] " << command->desciption << std::flush;
+                    if(events)
+                    {
+                        events->post(events->event("action_started")
+                            .field("index", command->index)
+                            .field("description", command->desciption)
+                            .field("output", command->outputs.empty() ? std::string_view() : std::string_view(command->outputs.front())));
+                    }
+
+                    command->result = std::async(std::launch::async, [command, events, &doneMutex, &doneCommands, &directoryCache](){
+                        profile::Scope scope("Run command", command->desciption);
+                        for(auto& output : command->outputs)
+                        {
+                            std::error_code ec;
+                            directoryCache.create(std::filesystem::path(output.cstr()).parent_path(), ec);
+                        }
+
+                        auto postOutput = [command, events](std::string_view output)
+                        {
+                            events->post(events->event("output").field("index", command->index).field("text", output));
+                        };
+
+                        process::ProcessResult result;
+                        if(command->callable)
+                        {
+                            result = runCallable(*command->callable);
+                        }
+                        else if(!command->builtins.empty())
+                        {
+                            result = runBuiltins(command->builtins, directoryCache);
+                        }
+                        else
+                        {
+                            result = process::run("cd \"" + command->workingDirectory + "\" && " + command->commandPrefix.cstr() + command->commandString + " 2>&1", false, command->timeout, events ? postOutput : std::function<void(std::string_view)>());
+                        }
+
+                        // Only commands run as processes report output as it arrives
+                        if(events && (command->callable || !command->builtins.empty()) && !result.output.empty())
+                        {
+                            postOutput(result.output);
+                        }
+                        {
+                            std::scoped_lock doneLock(doneMutex);
+                            doneCommands.push_back(command);
+                        }
+                        return result;
+                    });
+                    runningCommands.push_back(command);
+                }
             }
 
             if((!command->dirty || command->result.valid()) && !skipped)
@@ -356,9 +1004,50 @@ size_t DirectBuilder::runCommands(const std::vector<PendingCommand*>& commands,
     return count;
 }
 
-std::vector<PendingCommand*> DirectBuilder::processCommands(std::vector<PendingCommand>& pendingCommands)
+std::vector<PendingCommand*> DirectBuilder::processCommands(std::pmr::vector<PendingCommand>& pendingCommands)
 {
-    std::unordered_map<StringId, PendingCommand*> commandMap;
+    profile::Scope scope("Dirty checking");
+    auto arena = pendingCommands.get_allocator().resource();
+
+    auto sameCommand = [](const PendingCommand& a, const PendingCommand& b)
+    {
+        auto callableId = [](const PendingCommand& command) { return command.callable ? command.callable->id : std::string(); };
+        return a.commandPrefix == b.commandPrefix && a.commandString == b.commandString &&
+               a.workingDirectory == b.workingDirectory && callableId(a) == callableId(b) &&
+               a.inputs == b.inputs && a.outputs == b.outputs;
+    };
+
+    // Projects sharing objects emit the same command more than once, but it
+    // only needs to run once. Different commands writing the same output
+    // would overwrite each other's results.
+    std::pmr::unordered_map<StringId, size_t> firstByOutput(arena);
+    size_t kept = 0;
+    for(size_t i = 0; i < pendingCommands.size(); ++i)
+    {
+        auto& command = pendingCommands[i];
+        if(!command.outputs.empty())
+        {
+            auto [it, inserted] = firstByOutput.insert({ command.outputs.front(), kept });
+            if(!inserted)
+            {
+                auto& first = pendingCommands[it->second];
+                if(!sameCommand(first, command))
+                {
+                    throw std::runtime_error("Conflicting commands for output '" + std::string(command.outputs.front()) + "'.");
+                }
+                first.dirty |= command.dirty;
+                continue;
+            }
+        }
+        if(kept != i)
+        {
+            pendingCommands[kept] = std::move(command);
+        }
+        ++kept;
+    }
+    pendingCommands.erase(pendingCommands.begin() + kept, pendingCommands.end());
+
+    std::pmr::unordered_map<StringId, PendingCommand*> commandMap(arena);
     for(auto& command : pendingCommands)
     {
         for(auto& output : command.outputs)
@@ -382,7 +1071,7 @@ std::vector<PendingCommand*> DirectBuilder::processCommands(std::vector<PendingC
 
     using It = decltype(pendingCommands.begin());
     It next = pendingCommands.begin();
-    std::vector<std::pair<PendingCommand*, int>> stack;
+    std::pmr::vector<std::pair<PendingCommand*, int>> stack(arena);
     stack.reserve(pendingCommands.size());
     std::vector<PendingCommand*> outputCommands;
     outputCommands.reserve(pendingCommands.size());
@@ -417,19 +1106,29 @@ std::vector<PendingCommand*> DirectBuilder::processCommands(std::vector<PendingC
 
     std::sort(outputCommands.begin(), outputCommands.end(), [](auto a, auto b) { return a->depth > b->depth; });
     
-    TimeCache timeCache;
+    auto& timeCache = statCache();
     
     for(auto command : outputCommands)
     {
+        if(command->dirty) continue;
+
+        // If the dirty dependencies might not write their outputs, this command
+        // is checked as well, in case it can be skipped later
+        bool dependencyDirty = false;
+        bool mayBeClean = true;
         for(auto dependency : command->dependencies)
         {
             if(dependency->dirty)
             {
-                command->dirty = true;
-                break;
+                dependencyDirty = true;
+                mayBeClean = mayBeClean && (dependency->restat || dependency->dirtyFromDependencies);
             }
         }
-        if(command->dirty) continue;
+        if(dependencyDirty && !mayBeClean)
+        {
+            command->dirty = true;
+            continue;
+        }
 
         std::filesystem::file_time_type outputTime;
         outputTime = outputTime.max();
@@ -446,6 +1145,15 @@ std::vector<PendingCommand*> DirectBuilder::processCommands(std::vector<PendingC
         }
         if(command->dirty) continue;
 
+        if(command->restat && !command->outputs.empty())
+        {
+            auto stampTime = timeCache.get(restatStamp(*command), ec);
+            if(!ec)
+            {
+                outputTime = std::max(outputTime, stampTime);
+            }
+        }
+
         for(auto& input : command->inputs)
         {
             auto inputTime = timeCache.get(input, ec);
@@ -467,7 +1175,7 @@ std::vector<PendingCommand*> DirectBuilder::processCommands(std::vector<PendingC
 
         if(!command->depFile.empty())
         {
-            auto data = file::read(command->depFile.cstr());
+            file::MappedFile data(command->depFile.cstr());
             if(data.empty())
             {
                 // LOG std::cout << "dirty: \"" << command->depFile << "\" did not exist.\n";
@@ -475,7 +1183,7 @@ std::vector<PendingCommand*> DirectBuilder::processCommands(std::vector<PendingC
             }
             else
             {
-                bool dirty = parseDependencyData(data, [&outputTime, &timeCache](std::string_view path)
+                bool dirty = parseDependencyData(data.view(), [&outputTime, &timeCache](std::string_view path)
                 {
                     std::error_code ec;
                     auto inputTime = timeCache.get(path, ec);
@@ -496,6 +1204,12 @@ std::vector<PendingCommand*> DirectBuilder::processCommands(std::vector<PendingC
                 command->dirty = dirty;
             }            
         }
+
+        if(dependencyDirty && !command->dirty)
+        {
+            command->dirty = true;
+            command->dirtyFromDependencies = true;
+        }
     }
 
     outputCommands.erase(std::remove_if(outputCommands.begin(), outputCommands.end(), [](auto command) { return !command->dirty; }), outputCommands.end());
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "util/file.h"
+#include "util/memory.h"
+#include "util/process.h"
+#include "util/string.h"
+
+// History of the resources used by the most recent successful run of each
+// command in a build directory, keyed by the first output of the command.
+class BuildLog
+{
+public:
+    struct Entry
+    {
+        std::string description;
+        process::ResourceUsage usage;
+    };
+
+    BuildLog(std::filesystem::path path)
+        : _path(std::move(path))
+    {
+        file::MappedFile data(_path);
+        auto view = data.view();
+
+        std::string_view line;
+        std::tie(line, view) = str::split(view, '\n');
+        if(line != header)
+        {
+            return;
+        }
+
+        while(!view.empty())
+        {
+            std::tie(line, view) = str::split(view, '\n');
+            auto fields = str::splitAll(line, '\t');
+            if(fields.size() != 10)
+            {
+                continue;
+            }
+
+            auto toDouble = [](std::string_view str) { return std::strtod(std::string(str).c_str(), nullptr); };
+            auto toInt = [](std::string_view str) { return (uint64_t)std::strtoull(std::string(str).c_str(), nullptr, 10); };
+
+            Entry entry;
+            entry.usage.wallTime = toDouble(fields[1]);
+            entry.usage.userTime = toDouble(fields[2]);
+            entry.usage.systemTime = toDouble(fields[3]);
+            entry.usage.peakMemory = toInt(fields[4]);
+            entry.usage.blockInputs = toInt(fields[5]);
+            entry.usage.blockOutputs = toInt(fields[6]);
+            entry.usage.voluntaryContextSwitches = toInt(fields[7]);
+            entry.usage.involuntaryContextSwitches = toInt(fields[8]);
+            entry.description = fields[9];
+            _entries[std::string(fields[0])] = std::move(entry);
+        }
+    }
+
+    void record(std::string_view output, std::string_view description, const process::ResourceUsage& usage)
+    {
+        std::string cleanDescription(description);
+        std::replace_if(cleanDescription.begin(), cleanDescription.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+        _entries[std::string(output)] = { std::move(cleanDescription), usage };
+        _changed = true;
+    }
+
+    void write()
+    {
+        if(!_changed)
+        {
+            return;
+        }
+
+        std::ostringstream stream;
+        stream << header << "\n";
+        for(auto& [output, entry] : _entries)
+        {
+            auto& usage = entry.usage;
+            stream << output << "\t"
+                   << usage.wallTime << "\t"
+                   << usage.userTime << "\t"
+                   << usage.systemTime << "\t"
+                   << usage.peakMemory << "\t"
+                   << usage.blockInputs << "\t"
+                   << usage.blockOutputs << "\t"
+                   << usage.voluntaryContextSwitches << "\t"
+                   << usage.involuntaryContextSwitches << "\t"
+                   << entry.description << "\n";
+        }
+        file::write(_path, stream.str());
+        _changed = false;
+    }
+
+    // Prints the top entries by each metric.
+    void printReport(std::ostream& stream, size_t count) const
+    {
+        auto seconds = [](double value) {
+            std::ostringstream result;
+            result << std::fixed << std::setprecision(2) << value << "s";
+            return result.str();
+        };
+        auto megabytes = [](double value) {
+            std::ostringstream result;
+            result << std::fixed << std::setprecision(1) << value / (1024.0 * 1024.0) << "MB";
+            return result.str();
+        };
+        auto number = [](double value) {
+            return std::to_string((uint64_t)value);
+        };
+
+        printMetric(stream, count, "wall time", seconds, [](auto& usage) { return usage.wallTime; });
+        printMetric(stream, count, "CPU time (user + system)", seconds, [](auto& usage) { return usage.userTime + usage.systemTime; });
+        printMetric(stream, count, "peak memory", megabytes, [](auto& usage) { return (double)usage.peakMemory; });
+        printMetric(stream, count, "block I/O operations (in + out)", number, [](auto& usage) { return (double)(usage.blockInputs + usage.blockOutputs); });
+        printMetric(stream, count, "context switches (voluntary + involuntary)", number, [](auto& usage) { return (double)(usage.voluntaryContextSwitches + usage.involuntaryContextSwitches); });
+    }
+
+    size_t size() const
+    {
+        return _entries.size();
+    }
+
+    size_t heapSize() const
+    {
+        size_t size = memory::heapSize(_path);
+        for(auto& [output, entry] : _entries)
+        {
+            size += memory::nodeSize(sizeof(std::pair<const std::string, Entry>), 3) + memory::heapSize(output) + memory::heapSize(entry.description);
+        }
+        return size;
+    }
+
+private:
+    static constexpr std::string_view header = "# build.h log v1";
+
+    void printMetric(std::ostream& stream, size_t count, std::string_view title, std::function<std::string(double)> format, std::function<double(const process::ResourceUsage&)> metric) const
+    {
+        std::vector<std::pair<double, const Entry*>> sorted;
+        sorted.reserve(_entries.size());
+        for(auto& [output, entry] : _entries)
+        {
+            double value = metric(entry.usage);
+            if(value > 0)
+            {
+                sorted.push_back({ value, &entry });
+            }
+        }
+
+        if(sorted.empty())
+        {
+            return;
+        }
+
+        count = std::min(count, sorted.size());
+        std::partial_sort(sorted.begin(), sorted.begin() + count, sorted.end(), [](auto& a, auto& b) { return a.first > b.first; });
+
+        stream << "Top " << count << " by " << title << ":\n";
+        for(size_t i = 0; i < count; ++i)
+        {
+            stream << str::padLeftToSize(format(sorted[i].first), 12) << "  " << sorted[i].second->description << "\n";
+        }
+    }
+
+    std::filesystem::path _path;
+    std::map<std::string, Entry> _entries;
+    bool _changed = false;
+};
@@ -164,8 +164,8 @@ std::vector<std::filesystem::path> ClToolchainProvider::process(Project& project
 
     auto dataDir = resolvedSettings.dataDir;
 
-    std::unordered_map<Language, std::string, std::hash<StringId>> commonCompilerFlags;
-    auto getCommonCompilerCommand = [&](Language language) -> const std::string& {
+    std::unordered_map<Language, StringId, std::hash<StringId>> commonCompilerFlags;
+    auto getCommonCompilerCommand = [&](Language language) -> StringId {
         auto it = commonCompilerFlags.find(language);
         if(it != commonCompilerFlags.end())
         {
@@ -192,12 +192,13 @@ std::vector<std::filesystem::path> ClToolchainProvider::process(Project& project
         }
 
         auto inputStr = (pathOffset / input.path).string();
-        auto output = dataDir / std::filesystem::path("obj") / project.name / (input.path.relative_path().string() + ".o");
+        auto commandPrefix = getCommonCompilerCommand(language);
+        auto output = getObjectPath(project, resolvedSettings, input.path, commandPrefix, inputStr);
         auto outputStr = (pathOffset / output).string();
 
         CommandEntry command;
-        command.command = getCommonCompilerCommand(language) + 
-                          getCompilerFlags(project, resolvedSettings, pathOffset, language, inputStr, outputStr);
+        command.commandPrefix = commandPrefix;
+        command.command = getCompilerFlags(project, resolvedSettings, pathOffset, language, inputStr, outputStr);
         command.inputs = { input.path };
         command.outputs = { output };
         command.workingDirectory = workingDir;
@@ -1,34 +1,72 @@
 #include "emitters/compilecommands.h"
+#include "util/profile.h"
 CompileCommands::CompileCommands()
     : Emitter("compilecommands", "Generate a compilecommands.json file.")
 { }
 
 void CompileCommands::emit(Environment& env)
 {
-    std::filesystem::create_directories(*targetPath.value);
-    std::ofstream stream(*targetPath.value / "compile_commands.json");
-    
-    stream << "[\n";
+    auto projects = env.collectProjects();
+    auto configs = env.collectConfigs();
+
+    if(selectedConfig)
+    {
+        if(std::find(configs.begin(), configs.end(), *selectedConfig) == configs.end())
+        {
+            throw std::runtime_error("Selected config '" + std::string(*selectedConfig) + "' has not been used in build configuration.");
+        }
+    }
 
 #if TODO
     auto [generator, buildOutput] = createGeneratorProject(targetPath);
     emitCommands(stream, targetPath, generator, "", true);
 #endif
 
-    auto projects = env.collectProjects();
-    auto configs = env.collectConfigs();
+    std::vector<std::string> entries;
     for(auto config : configs)
     {
+        if(selectedConfig && config != *selectedConfig)
+        {
+            continue;
+        }
+
+        profile::Scope scope("Collect commands", config);
         for(auto project : projects)
         {
-            emitCommands(stream, *targetPath.value, *project, config, false);
+            auto projectEntries = emitCommands(*targetPath, *project, config);
+            if(!projectEntries.empty())
+            {
+                entries.push_back(std::move(projectEntries));
+            }
         }
     }
-    
-    stream << "\n]\n";
+
+    profile::Scope scope("Write compile commands");
+    size_t size = 0;
+    for(auto& projectEntries : entries)
+    {
+        size += projectEntries.size() + 2;
+    }
+
+    std::string data;
+    data.reserve(size + 8);
+    data += "[\n";
+    for(auto& projectEntries : entries)
+    {
+        if(&projectEntries != &entries.front())
+        {
+            data += ",\n";
+        }
+        data += projectEntries;
+    }
+    data += "\n]\n";
+
+    // Left untouched when nothing has changed, since rewriting it makes
+    // tools like clangd reindex everything.
+    file::write(*targetPath / "compile_commands.json", data, file::Durability::Synced);
 }
 
-void CompileCommands::emitCommands(std::ostream& stream, const std::filesystem::path& root, Project& project, StringId config, bool first)
+std::string CompileCommands::emitCommands(const std::filesystem::path& root, Project& project, StringId config)
 {
     auto resolved = project.resolve(config, OperatingSystem::current());
 
@@ -46,7 +84,7 @@ void CompileCommands::emitCommands(std::ostream& stream, const std::filesystem::
 
     if(!project.type.has_value())
     {
-        return;
+        return {};
     }
 
     if(project.name.empty())
@@ -66,12 +104,17 @@ void CompileCommands::emitCommands(std::ostream& stream, const std::filesystem::
         toolchain = defaultToolchain;
     }
 
-    auto toolchainOutputs = toolchain->process(project, resolved, config, {});
+    std::vector<std::filesystem::path> toolchainOutputs;
+    {
+        profile::Scope scope("Toolchain processing", project.name);
+        toolchainOutputs = toolchain->process(project, resolved, config, {});
+    }
 
+    std::string result;
     auto absCwd = std::filesystem::absolute(std::filesystem::current_path());
     for(auto& command : commands)
     {
-        if(command.inputs.empty())
+        if(command.inputs.empty() || command.callable)
         {
             continue;
         }
@@ -79,17 +122,18 @@ void CompileCommands::emitCommands(std::ostream& stream, const std::filesystem::
         std::filesystem::path cwd = absCwd / command.workingDirectory;
 
         // Assuming first input is the main input
-        if(!first)
+        if(!result.empty())
         {
-            stream << ",\n";
+            result += ",\n";
         }
-        first = false;
-        stream << "  {\n";
-        stream << "    \"directory\": " << cwd << ",\n";
-        stream << "    \"file\": " << command.inputs.front() << ",\n";
-        stream << "    \"command\": " << str::quote(command.command) << "\n";
-        stream << "  }";
+        result += "  {\n";
+        result += "    \"directory\": " + str::quote(cwd.string()) + ",\n";
+        result += "    \"file\": " + str::quote(command.inputs.front().string()) + ",\n";
+        result += "    \"command\": " + str::quote(command.commandLine()) + "\n";
+        result += "  }";
     }
+
+    return result;
 }
 
 CompileCommands CompileCommands::instance;
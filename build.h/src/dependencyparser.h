@@ -1,15 +1,102 @@
 #pragma once
 
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BUILD_H_DEPENDENCY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define BUILD_H_DEPENDENCY_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+inline uint32_t countTrailingZeros(uint32_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return index;
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+// Finds the first occurrence of any of the given characters, starting at pos.
+// Dependency files are mostly long runs of path characters, so this scans
+// a vector register at a time when possible.
+template<char... Chars>
+size_t findAnyOf(std::string_view data, size_t pos)
+{
+    const char* ptr = data.data();
+    const size_t size = data.size();
+
+#if BUILD_H_DEPENDENCY_AVX2
+    while(pos + 32 <= size)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + pos));
+        __m256i match = _mm256_setzero_si256();
+        ((match = _mm256_or_si256(match, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(Chars)))), ...);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(match);
+        if(mask)
+        {
+            return pos + countTrailingZeros(mask);
+        }
+        pos += 32;
+    }
+#endif
+
+#if BUILD_H_DEPENDENCY_SSE2
+    while(pos + 16 <= size)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + pos));
+        __m128i match = _mm_setzero_si128();
+        ((match = _mm_or_si128(match, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Chars)))), ...);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(match);
+        if(mask)
+        {
+            return pos + countTrailingZeros(mask);
+        }
+        pos += 16;
+    }
+#endif
+
+    for(; pos < size; ++pos)
+    {
+        char c = ptr[pos];
+        if(((c == Chars) || ...))
+        {
+            return pos;
+        }
+    }
+
+    return std::string_view::npos;
+}
+
+// Parses either a gcc style Makefile dependency file or an MSVC /sourceDependencies
+// json file, and calls callable with each dependency path until it returns true.
+// Paths are passed as views into data, except for the rare paths containing
+// escapes, which are unescaped into a scratch buffer that is only valid for the
+// duration of the call.
 template<typename Callable>
-bool parseDependencyData(std::string& data, Callable callable)
+bool parseDependencyData(std::string_view data, Callable callable)
 {
     size_t pos = 0;
+    std::string scratch;
+
     auto skipWhitespace = [&](){
         while(pos < data.size())
         {
-            char c = data[pos];
-            if(!std::isspace(data[pos]) && 
-                (data[pos] != '\\' || pos == data.size()-1 || !std::isspace(data[pos+1])))
+            if(!std::isspace((unsigned char)data[pos]) &&
+                (data[pos] != '\\' || pos == data.size()-1 || !std::isspace((unsigned char)data[pos+1])))
             {
                 break;
             }
@@ -17,86 +104,92 @@ bool parseDependencyData(std::string& data, Callable callable)
         }
     };
 
-    std::string_view spaces(" \n");
     auto readGccPath = [&](){
         size_t start = pos;
-        size_t lastBreak = pos;
-        size_t offset = 0;
-        bool stop = false;
-        while(!stop)
+        size_t segmentStart = pos;
+        bool escaped = false;
+        while(true)
         {
-            bool space = false;
-            pos = data.find_first_of(spaces, pos+1);
-            if(pos == std::string::npos)
+            pos = findAnyOf<' ', '\n'>(data, pos+1);
+            if(pos == std::string_view::npos)
             {
                 pos = data.size();
-                stop = true;
+                break;
             }
-            else
+
+            if(data[pos-1] != '\\')
             {
-                if(data[pos-1] != '\\')
-                {
-                    stop = true;
-                }
-                else
-                {
-                    space = true;
-                }
+                break;
             }
-            if(offset > 0)
+
+            if(data[pos] == '\n')
             {
-                memmove(data.data()+lastBreak-offset, data.data()+lastBreak, pos-lastBreak);
+                // Line continuation directly after a path
+                if(escaped)
+                {
+                    scratch.append(data.data() + segmentStart, pos-1-segmentStart);
+                    return std::string_view(scratch);
+                }
+                return data.substr(start, pos-1-start);
             }
-            if(space)
+
+            // Escaped space. Only now do we need to copy.
+            if(!escaped)
             {
-                ++offset;
+                scratch.clear();
+                escaped = true;
             }
-            lastBreak = pos;
+            scratch.append(data.data() + segmentStart, pos-1-segmentStart);
+            segmentStart = pos;
         }
 
-        return std::string_view(data.data() + start, pos-offset-start);
+        if(escaped)
+        {
+            scratch.append(data.data() + segmentStart, pos-segmentStart);
+            return std::string_view(scratch);
+        }
+        return data.substr(start, pos-start);
     };
 
     // This is a quick and ugly parser that will do the wrong thing on all escape sequences but \\ and \"
-    std::string_view escapeOrQuote("\\\"");
     auto readClPath = [&](){
         size_t start = pos;
-        size_t lastBreak = pos;
-        size_t offset = 0;
-        bool stop = false;
-        while(!stop)
+        size_t segmentStart = pos;
+        bool escaped = false;
+        while(true)
         {
-            bool escape = false;
-            pos = data.find_first_of(escapeOrQuote, pos+1);
-            if(pos == std::string::npos)
+            pos = findAnyOf<'\\', '"'>(data, pos);
+            if(pos == std::string_view::npos)
             {
                 pos = data.size();
-                stop = true;
+                break;
             }
-            else
+
+            if(data[pos] == '"')
             {
-                if(data[pos] == '\"')
-                {
-                    stop = true;
-                }
-                else
-                {
-                    ++pos;
-                    escape = true;
-                }
+                break;
             }
-            if(offset > 0)
+
+            if(!escaped)
             {
-                memmove(data.data()+lastBreak-offset, data.data()+lastBreak, pos-lastBreak);
+                scratch.clear();
+                escaped = true;
             }
-            if(escape)
+            scratch.append(data.data() + segmentStart, pos-segmentStart);
+            if(pos+1 < data.size())
             {
-                ++offset;
+                scratch.push_back(data[pos+1]);
             }
-            lastBreak = pos;
+            pos = std::min(pos+2, data.size());
+            segmentStart = pos;
         }
 
-        return std::string_view(data.data() + start, pos-offset-start);
+        if(escaped)
+        {
+            scratch.append(data.data() + segmentStart, pos-segmentStart);
+            return std::string_view(scratch);
+        }
+        return data.substr(start, pos-start);
     };
 
     auto consume = [&](char expected)
@@ -116,6 +209,11 @@ bool parseDependencyData(std::string& data, Callable callable)
         while(pos < data.size())
         {
             skipWhitespace();
+            if(pos >= data.size())
+            {
+                break;
+            }
+
             auto pathString = readGccPath();
             if(pathString.empty())
             {
@@ -158,10 +256,15 @@ bool parseDependencyData(std::string& data, Callable callable)
         {
             return true;
         }
-        
+
         while(pos < data.size())
         {
             skipWhitespace();
+            if(consume(']'))
+            {
+                break;
+            }
+
             if(!consume('"'))
             {
                 return true;
@@ -174,12 +277,7 @@ bool parseDependencyData(std::string& data, Callable callable)
                 return true;
             }
 
-            if(pathString.empty())
-            {
-                continue;
-            }
-
-            if(callable(pathString))
+            if(!pathString.empty() && callable(pathString))
             {
                 return true;
             }
@@ -197,4 +295,4 @@ bool parseDependencyData(std::string& data, Callable callable)
     }
 
     return false;
-}
\ No newline at end of file
+}
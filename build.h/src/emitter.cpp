@@ -1,5 +1,11 @@
 #include "core/emitter.h"
+#include "modules/toolchain.h"
+#include "toolchains/detected.h"
+#include "toolchains/gcclike.h"
 #include "util/glob.h"
+#include "util/hash.h"
+
+#include <algorithm>
 
 static std::vector<Emitter*>& getEmitters()
 {
@@ -17,6 +23,12 @@ const std::vector<Emitter*>& Emitters::list()
     return getEmitters();
 }
 
+void Emitters::truncate(size_t count)
+{
+    auto& emitters = getEmitters();
+    emitters.resize(std::min(count, emitters.size()));
+}
+
 Emitter::Emitter(StringId name, std::string description)
     : name(name)
     , description(std::move(description))
@@ -28,21 +40,79 @@ std::pair<Project*, std::filesystem::path> Emitter::createGeneratorProject(Envir
 {
     targetPath = targetPath / ".build.h";
     std::string ext;
+    std::string libExt = ".a";
     if(OperatingSystem::current() == Windows)
     {
         ext = ".exe";
+        libExt = ".lib";
+    }
+
+    std::vector<Feature> features = { feature::Cpp17, feature::DebugSymbols, feature::Exceptions, feature::Optimize };
+
+    auto buildOutput = std::filesystem::path(env.configurationFile).replace_extension(ext);
+
+    // The hot reload host is a stable executable that already contains build.h,
+    // so only the configuration itself is built, as a module it can load.
+    if(!env.generatorModule.empty())
+    {
+        auto tempModule = targetPath / env.generatorModule.filename();
+        auto prevModule = targetPath / env.generatorModule.filename().replace_extension(".so.prev");
+        Project& project = env.createProject(std::string(generatorProjectName), SharedLib);
+        project.links = std::vector<Project*>();
+        project.features += features;
+        project.includePaths += env.buildHDir;
+        project.defines += "BUILD_H_MODULE";
+        if(OperatingSystem::current() == MacOS)
+        {
+            project.ext<extensions::Gcc>().linkerFlags += { "-undefined", "dynamic_lookup" };
+        }
+        project.output.path = tempModule;
+        project.files += env.configurationFile;
+        // The loaded module is moved aside rather than overwritten, since the
+        // host still has it mapped.
+        project.commands += commands::chain({commands::move(env.generatorModule, prevModule), commands::copy(tempModule, env.generatorModule)}, "Replacing '" + env.generatorModule.filename().string() + "'.");
+        return { &project, buildOutput };
+    }
+
+    // build.h's own sources rarely change, so they're built once into a library
+    // that is kept for each toolchain and set of flags. Editing the build
+    // configuration then only recompiles one file and relinks.
+    std::string coreKey = std::string(defaultToolchain->name) + "\n" + env.buildHDir.string();
+    for(auto& feature : features)
+    {
+        coreKey += "\n" + std::string(feature);
     }
+    auto coreHash = hash::toHex(hash::fingerprint(coreKey)).substr(0, 16);
+
+    Project& core = env.createProject(std::string(generatorCoreProjectPrefix) + coreHash, StaticLib);
+    core.links = std::vector<Project*>();
+    core.features += features;
+    core.includePaths += env.buildHDir;
+    core.output.path = targetPath / ("core-" + coreHash) / ("buildh" + libExt);
+    core.files += glob::files(env.buildHDir / "src");
+
     auto tempOutput = targetPath / std::filesystem::path(env.configurationFile).filename().replace_extension(ext);
     auto prevOutput = targetPath / std::filesystem::path(env.configurationFile).filename().replace_extension(ext + ".prev");
-    auto buildOutput = std::filesystem::path(env.configurationFile).replace_extension(ext);
-    Project& project = env.createProject("_generator", Executable);
-    project.links = std::vector<Project*>(); 
-    project.features += { feature::Cpp17, feature::DebugSymbols, feature::Exceptions, feature::Optimize };
+    Project& project = env.createProject(std::string(generatorProjectName), Executable);
+    project.links = std::vector<Project*>{ &core };
+    project.features += features;
     project.includePaths += env.buildHDir;
     project.output.path = tempOutput;
     project.files += env.configurationFile;
-    project.files += glob::files(env.buildHDir / "src");
     project.commands += commands::chain({commands::move(buildOutput, prevOutput), commands::copy(tempOutput, buildOutput)}, "Replacing '" + buildOutput.filename().string() + "'.");
 
+    // The cl toolchain doesn't support PCH yet
+    if(OperatingSystem::current() != Windows)
+    {
+        auto pchHeader = env.buildHDir / "src" / "pch.h";
+        core.importPch = pchHeader;
+        project.importPch = pchHeader;
+    }
+
     return { &project, buildOutput };
 }
+
+bool Emitter::isGeneratorProject(const Project& project)
+{
+    return project.name == generatorProjectName || str::startsWith(project.name, generatorCoreProjectPrefix);
+}
@@ -1,5 +1,14 @@
 #include "core/environment.h"
 #include "util/process.h"
+#include "util/profile.h"
+
+#include <atomic>
+#include <exception>
+#include <thread>
+
+// Projects created by the parallelFor task running on this thread, which are
+// added to the environment in order once all tasks are done.
+static thread_local std::vector<std::unique_ptr<Project>>* taskProjects = nullptr;
 
 Environment::Environment(cli::Context& cliContext)
     : defaults(createProject())
@@ -26,17 +35,108 @@ Environment::~Environment()
 
 Project& Environment::createProject(std::string name, std::optional<ProjectType> type)
 {
-    _projects.emplace_back(new Project(name, type));
-    if(_projects.size() > 1)
+    std::unique_ptr<Project> project(new Project(name, type));
+    auto& result = *project;
+
+    if(taskProjects)
+    {
+        result.links += &defaults;
+        taskProjects->push_back(std::move(project));
+        return result;
+    }
+
+    std::scoped_lock lock(_projectsMutex);
+    if(!_projects.empty())
+    {
+        result.links += &defaults;
+    }
+    _projects.push_back(std::move(project));
+    return result;
+}
+
+void Environment::runParallel(size_t count, const std::function<void(size_t index)>& function)
+{
+    profile::Scope scope("Parallel tasks");
+
+    std::vector<std::vector<std::unique_ptr<Project>>> createdProjects(count);
+    std::vector<std::exception_ptr> exceptions(count);
+    auto outerProjects = taskProjects;
+
+    std::atomic<size_t> next = 0;
+    auto worker = [&](){
+        for(size_t index = next++; index < count; index = next++)
+        {
+            taskProjects = &createdProjects[index];
+            try
+            {
+                function(index);
+            }
+            catch(...)
+            {
+                exceptions[index] = std::current_exception();
+            }
+        }
+        taskProjects = nullptr;
+    };
+
+    size_t threadCount = std::min(process::availableConcurrency(), count);
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < threadCount; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // Nested calls add their projects to the task they were called from
+    taskProjects = outerProjects;
+    {
+        std::unique_lock<std::mutex> lock;
+        auto& destination = outerProjects ? *outerProjects : _projects;
+        if(!outerProjects)
+        {
+            lock = std::unique_lock(_projectsMutex);
+        }
+        for(auto& projects : createdProjects)
+        {
+            for(auto& project : projects)
+            {
+                destination.push_back(std::move(project));
+            }
+        }
+    }
+
+    for(auto& exception : exceptions)
+    {
+        if(exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+}
+
+Project* Environment::findProject(std::string_view name)
+{
+    std::scoped_lock lock(_projectsMutex);
+    for(auto& project : _projects)
     {
-        _projects.back()->links += &defaults;
+        if(project->name == name)
+        {
+            return project.get();
+        }
     }
-    return *_projects.back();
+
+    return nullptr;
 }
 
 std::vector<Project*> Environment::collectProjects()
 {
     // TODO: Probably possible to do this more efficiently
+    profile::Scope scope("Collect projects");
+    std::scoped_lock lock(_projectsMutex);
 
     std::vector<Project*> orderedProjects;
     std::set<Project*> collectedProjects;
@@ -49,15 +149,31 @@ std::vector<Project*> Environment::collectProjects()
     return orderedProjects;
 }
 
+std::vector<Project*> Environment::collectProjects(const std::vector<Project*>& roots)
+{
+    profile::Scope scope("Collect projects");
+    std::vector<Project*> orderedProjects;
+    std::set<Project*> collectedProjects;
+
+    for(auto project : roots)
+    {
+        collectOrderedProjects(project, collectedProjects, orderedProjects);
+    }
+
+    return orderedProjects;
+}
+
 std::vector<StringId> Environment::collectConfigs()
 {
     std::set<StringId> configs;
 
+    std::scoped_lock lock(_projectsMutex);
     for(auto& project : _projects)
     {
         for(auto& config : project->configs)
         {
-            if(config.first.name.has_value())
+            // Properties added for the unnamed config don't make it a config
+            if(config.first.name.has_value() && !config.first.name->empty())
             {
                 configs.insert(*config.first.name);
             }
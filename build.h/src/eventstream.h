@@ -0,0 +1,273 @@
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#if !_WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "util/string.h"
+
+// A newline delimited JSON object describing something that happened during
+// a build. Every event has a "type" and the seconds since the stream was opened.
+class Event
+{
+public:
+    Event(std::string_view type, double time)
+    {
+        _json = "{\"type\":" + str::jsonQuote(type) + ",\"time\":" + std::to_string(time);
+    }
+
+    Event& field(std::string_view name, std::string_view value)
+    {
+        _json += "," + str::jsonQuote(name) + ":" + str::jsonQuote(value);
+        return *this;
+    }
+
+    Event& field(std::string_view name, const char* value)
+    {
+        return field(name, std::string_view(value));
+    }
+
+    Event& field(std::string_view name, int64_t value)
+    {
+        _json += "," + str::jsonQuote(name) + ":" + std::to_string(value);
+        return *this;
+    }
+
+    Event& field(std::string_view name, size_t value)
+    {
+        return field(name, (int64_t)value);
+    }
+
+    Event& field(std::string_view name, int value)
+    {
+        return field(name, (int64_t)value);
+    }
+
+    Event& field(std::string_view name, double value)
+    {
+        _json += "," + str::jsonQuote(name) + ":" + std::to_string(value);
+        return *this;
+    }
+
+    Event& field(std::string_view name, bool value)
+    {
+        _json += "," + str::jsonQuote(name) + ":" + (value ? "true" : "false");
+        return *this;
+    }
+
+    std::string line() const
+    {
+        return _json + "}\n";
+    }
+
+private:
+    std::string _json;
+};
+
+// Writes build events for dashboards and IDEs following a build. The target
+// is a file path to append to, "fd:<n>" for a file descriptor inherited from
+// the parent process, or "unix:<path>" for a Unix domain socket. Only file
+// paths are supported on Windows. Events are queued and written by a separate
+// thread, so a slow reader never delays starting commands. Events are dropped
+// once writing fails, e.g. if the reader goes away.
+class EventStream
+{
+public:
+    EventStream(const std::string& target)
+        : _start(std::chrono::steady_clock::now())
+    {
+#if _WIN32
+        _file.open(target, std::ios_base::binary | std::ios_base::app);
+        if(!_file)
+        {
+            throw std::runtime_error("Failed to open event stream '" + target + "'.");
+        }
+#else
+        if(str::startsWith(target, "fd:"))
+        {
+            const char* number = target.c_str() + 3;
+            char* end = nullptr;
+            errno = 0;
+            long fd = std::strtol(number, &end, 10);
+            // strtol skips leading space and accepts signs, neither of which
+            // belongs in a descriptor number.
+            if(!std::isdigit((unsigned char)*number) || *end != '\0' || errno == ERANGE || fd > INT_MAX)
+            {
+                throw std::runtime_error("Invalid event stream file descriptor '" + target.substr(3) + "'.");
+            }
+            _fd = (int)fd;
+            _ownsFd = false;
+            struct stat statData;
+            if(fstat(_fd, &statData) != 0)
+            {
+                throw std::runtime_error("Event stream file descriptor " + target.substr(3) + " is not open.");
+            }
+        }
+        else if(str::startsWith(target, "unix:"))
+        {
+            auto path = target.substr(5);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if(path.size() >= sizeof(address.sun_path))
+            {
+                throw std::runtime_error("Event stream socket path '" + path + "' is too long.");
+            }
+            memcpy(address.sun_path, path.c_str(), path.size());
+
+            _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(_fd < 0 || connect(_fd, (sockaddr*)&address, sizeof(address)) != 0)
+            {
+                if(_fd >= 0)
+                {
+                    close(_fd);
+                }
+                throw std::runtime_error("Failed to connect to event stream socket '" + path + "'.");
+            }
+            fcntl(_fd, F_SETFD, FD_CLOEXEC);
+        }
+        else
+        {
+            _fd = open(target.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            if(_fd < 0)
+            {
+                throw std::runtime_error("Failed to open event stream '" + target + "'.");
+            }
+        }
+#endif
+
+        _thread = std::thread([this](){ writeLoop(); });
+    }
+
+    EventStream(const EventStream& other) = delete;
+    EventStream& operator=(const EventStream& other) = delete;
+
+    // Writes all queued events before returning.
+    ~EventStream()
+    {
+        {
+            std::scoped_lock lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_one();
+        _thread.join();
+
+#if !_WIN32
+        if(_ownsFd)
+        {
+            close(_fd);
+        }
+#endif
+    }
+
+    Event event(std::string_view type) const
+    {
+        return Event(type, std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count());
+    }
+
+    // Safe to call from any thread.
+    void post(const Event& event)
+    {
+        {
+            std::scoped_lock lock(_mutex);
+            _queue.push_back(event.line());
+        }
+        _condition.notify_one();
+    }
+
+private:
+    void writeLoop()
+    {
+#if !_WIN32
+        // A reader going away makes writes fail instead of killing the build
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+
+        std::unique_lock lock(_mutex);
+        while(true)
+        {
+            _condition.wait(lock, [this](){ return _stopping || !_queue.empty(); });
+            if(_queue.empty())
+            {
+                break;
+            }
+
+            // Everything queued so far is written in one go
+            std::string data;
+            for(auto& line : _queue)
+            {
+                data += line;
+            }
+            _queue.clear();
+
+            lock.unlock();
+            if(!_failed)
+            {
+                _failed = !write(data);
+            }
+            lock.lock();
+        }
+    }
+
+    bool write(std::string_view data)
+    {
+#if _WIN32
+        _file.write(data.data(), data.size());
+        _file.flush();
+        return (bool)_file;
+#else
+        while(!data.empty())
+        {
+            ssize_t written = ::write(_fd, data.data(), data.size());
+            if(written < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data.remove_prefix((size_t)written);
+        }
+        return true;
+#endif
+    }
+
+    std::chrono::steady_clock::time_point _start;
+#if _WIN32
+    std::ofstream _file;
+#else
+    int _fd = -1;
+    bool _ownsFd = true;
+#endif
+    bool _failed = false;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<std::string> _queue;
+    bool _stopping = false;
+    std::thread _thread;
+};
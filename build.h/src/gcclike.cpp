@@ -1,4 +1,6 @@
 #include "toolchains/gcclike.h"
+#include "util/hash.h"
+#include "util/process.h"
 
 GccLikeToolchainProvider::GccLikeToolchainProvider(std::string name, std::string compiler, std::string linker, std::string archiver)
     : ToolchainProvider(name) 
@@ -8,6 +10,46 @@ GccLikeToolchainProvider::GccLikeToolchainProvider(std::string name, std::string
 {
 }
 
+bool GccLikeToolchainProvider::isClang() const
+{
+    std::call_once(_compilerDetected, [this]() {
+        auto result = process::run(str::quote(compiler) + " --version 2>&1");
+        _clang = result.exitCode == 0 && result.output.find("clang") != std::string::npos;
+    });
+    return _clang;
+}
+
+std::filesystem::path GccLikeToolchainProvider::getPchPath(Project& project, ProjectSettings& resolvedSettings, const std::filesystem::path& header, Language language, std::string_view commonFlags) const
+{
+    auto pchDir = resolvedSettings.sharedDataDir.value() / std::filesystem::path("pch");
+    if(resolvedSettings.sharedDataDir.value().empty())
+    {
+        pchDir = resolvedSettings.dataDir.value() / std::filesystem::path("pch");
+    }
+
+    std::string key(commonFlags);
+    key += '\n';
+    key += std::string(language);
+    key += '\n';
+    key += std::filesystem::absolute(header).string();
+    auto flagsHash = hash::toHex(hash::fingerprint(key)).substr(0, 16);
+
+    // GCC finds "<header>.gch" when asked to include "<header>"
+    return pchDir / flagsHash / (header.filename().string() + (isClang() ? ".pch" : ".gch"));
+}
+
+std::string GccLikeToolchainProvider::getPchImportFlags(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, Language language, const std::filesystem::path& pch) const
+{
+    if(isClang())
+    {
+        return " -Xclang -include-pch -Xclang " + str::quote((pathOffset / pch).string());
+    }
+    else
+    {
+        return " -include " + str::quote((pathOffset / pch).replace_extension().string());
+    }
+}
+
 std::string GccLikeToolchainProvider::getCompiler(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, Language language) const
 {
     return compiler;
@@ -16,22 +58,24 @@ std::string GccLikeToolchainProvider::getCompiler(Project& project, ProjectSetti
 std::string GccLikeToolchainProvider::getCommonCompilerFlags(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, Language language, bool pch) const
 {
     std::string flags;
+    // GCC makes a .gch from any header compiled as such
+    std::string pchEmitFlags = pch && isClang() ? " -Xclang -emit-pch " : " ";
 
     if(language == lang::C)
     {
-        flags += pch ? " -x c-header -Xclang -emit-pch " : " -x c ";
+        flags += pch ? " -x c-header" + pchEmitFlags : " -x c ";
     }
     else if(language == lang::Cpp)
     {
-        flags += pch ? " -x c++-header -Xclang -emit-pch " : " -x c++ ";
+        flags += pch ? " -x c++-header" + pchEmitFlags : " -x c++ ";
     }
     else if(language == lang::ObjectiveC)
     {
-        flags += pch ? " -x objective-c-header -Xclang -emit-pch " : " -x objective-c ";
+        flags += pch ? " -x objective-c-header" + pchEmitFlags : " -x objective-c ";
     }
     else if(language == lang::ObjectiveCpp)
     {
-        flags += pch ? " -x objective-c++-header -Xclang -emit-pch " : " -x objective-c++ ";
+        flags += pch ? " -x objective-c++-header" + pchEmitFlags : " -x objective-c++ ";
     }
     else
     {
@@ -50,6 +94,10 @@ std::string GccLikeToolchainProvider::getCommonCompilerFlags(Project& project, P
     {
         flags += " -m64 -arch x86_64";
     }
+    if(project.type == SharedLib && OperatingSystem::current() != Windows)
+    {
+        flags += " -fPIC";
+    }
 
     std::unordered_map<Feature, std::string, std::hash<StringId>> featureMap = {
         { feature::Optimize, " -O2"},
@@ -200,11 +248,55 @@ std::string GccLikeToolchainProvider::getLinkerFlags(Project& project, ProjectSe
     return flags;
 }
 
+CommandEntry GccLikeToolchainProvider::getInterfaceStubCommand(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, const std::filesystem::path& library, const std::filesystem::path& workingDir) const
+{
+    // Import libraries serve the same purpose on Windows
+    if(OperatingSystem::current() == Windows)
+    {
+        return {};
+    }
+
+    auto stub = resolvedSettings.dataDir.value() / std::filesystem::path("obj") / project.name / (library.filename().string() + ".toc");
+    auto libraryStr = str::quote((pathOffset / library).string());
+    auto stubStr = str::quote((pathOffset / stub).string());
+    auto symbolsStr = str::quote((pathOffset / stub).string() + ".nm");
+    auto tempStr = str::quote((pathOffset / stub).string() + ".tmp");
+
+    // The library name and the exported symbols, without their addresses
+    std::string symbols;
+    std::string name;
+    if(OperatingSystem::current() == MacOS)
+    {
+        symbols = "nm -gUP " + libraryStr;
+        name = "otool -D " + libraryStr + " | tail -n +2";
+    }
+    else
+    {
+        symbols = "nm -D --defined-only -P " + libraryStr;
+        name = "readelf -d " + libraryStr + " | grep SONAME";
+    }
+
+    // Only replaced when the interface changed, so dependents aren't relinked otherwise
+    CommandEntry command;
+    command.command = symbols + " > " + symbolsStr + " && " +
+                      "{ " + name + "; cut -d' ' -f1,2 " + symbolsStr + "; } > " + tempStr + " && " +
+                      "rm " + symbolsStr + " && " +
+                      "if cmp -s " + tempStr + " " + stubStr + "; then rm " + tempStr + "; else mv " + tempStr + " " + stubStr + "; fi";
+    command.inputs = { library };
+    command.outputs = { stub };
+    command.workingDirectory = workingDir;
+    command.description = "Updating interface of " + project.name + ": " + library.string();
+    command.restat = true;
+    return command;
+}
+
 std::vector<std::filesystem::path> GccLikeToolchainProvider::process(Project& project, ProjectSettings& resolvedSettings, StringId config, const std::filesystem::path& workingDir) const
 {
     struct GccInternal : public PropertyBag
     {
         ListProperty<std::filesystem::path> linkedOutputs{this, true};
+        ListProperty<std::filesystem::path> linkedSharedLibs{this, true};
+        ListProperty<std::filesystem::path> linkedInterfaces{this, true};
     };
 
     std::filesystem::path pathOffset = std::filesystem::proximate(std::filesystem::current_path(), workingDir);
@@ -218,66 +310,60 @@ std::vector<std::filesystem::path> GccLikeToolchainProvider::process(Project& pr
 
     auto dataDir = resolvedSettings.dataDir;
 
-    auto buildPch = resolvedSettings.buildPch;
-    auto importPch = resolvedSettings.importPch;
-
-    // TODO: Do PCH management less hard coded, and only build PCHs for different languages if needed
-    if(!buildPch.value().empty())
+    // Precompiled headers are only built for the languages actually used, and
+    // placed by a hash of their flags so projects with the same flags share them.
+    std::vector<Language> languages;
+    for(auto& input : resolvedSettings.files)
     {
-        auto input = buildPch;
-        auto inputStr = (pathOffset / input).string();
-
-        auto output = dataDir / std::filesystem::path("pch") / (input.value().string() + ".pch");
-        auto outputStr = (pathOffset / output).string();
-
-        auto outputObjC = dataDir / std::filesystem::path("pch") / (input.value().string() + ".pchmm");
-        auto outputObjCStr = (pathOffset / outputObjC).string();
+        auto language = input.language != lang::Auto ? input.language : Language::getByPath(input.path);
+        if(language != lang::None && std::find(languages.begin(), languages.end(), language) == languages.end())
+        {
+            languages.push_back(language);
+        }
+    }
 
+    std::unordered_map<Language, std::string, std::hash<StringId>> pchFlags;
+    std::unordered_map<Language, std::filesystem::path, std::hash<StringId>> pchInputs;
+    auto addPch = [&](const std::filesystem::path& header, bool import) {
+        for(auto language : languages)
         {
+            auto compilerStr = str::quote(getCompiler(project, resolvedSettings, pathOffset, language));
+            auto output = getPchPath(project, resolvedSettings, header, language, compilerStr + getCommonCompilerFlags(project, resolvedSettings, pathOffset, language, false));
+            auto outputStr = (pathOffset / output).string();
+            auto inputStr = (pathOffset / header).string();
+
             CommandEntry command;
-            command.command = getCompiler(project, resolvedSettings, pathOffset, lang::Cpp) + 
-                                getCommonCompilerFlags(project, resolvedSettings, pathOffset, lang::Cpp, true) + 
-                                getCompilerFlags(project, resolvedSettings, pathOffset, lang::Cpp, inputStr, outputStr);
-            command.inputs = { input };
+            command.command = compilerStr +
+                              getCommonCompilerFlags(project, resolvedSettings, pathOffset, language, true) +
+                              getCompilerFlags(project, resolvedSettings, pathOffset, language, inputStr, outputStr);
+            command.inputs = { header };
             command.outputs = { output };
             command.workingDirectory = workingDir;
             command.depFile = output.string() + ".d";
-            command.description = "Compiling " + project.name + " PCH: " + input.value().string();
+            command.description = "Compiling " + project.name + " PCH (" + std::string(language) + "): " + header.string();
             resolvedSettings.commands += std::move(command);
-        }
 
-        {
-            CommandEntry command;
-            command.command = getCompiler(project, resolvedSettings, pathOffset, lang::ObjectiveCpp) + 
-                                getCommonCompilerFlags(project, resolvedSettings, pathOffset, lang::ObjectiveCpp, true) + 
-                                getCompilerFlags(project, resolvedSettings, pathOffset, lang::ObjectiveCpp, inputStr, outputObjCStr);
-            command.inputs = { input };
-            command.outputs = { outputObjC };
-            command.workingDirectory = workingDir;
-            command.depFile = outputObjC.string() + ".d";
-            command.description = "Compiling " + project.name + " PCH (Objective-C++): " + input.value().string();
-            resolvedSettings.commands += std::move(command);
+            if(import)
+            {
+                pchFlags[language] = getPchImportFlags(project, resolvedSettings, pathOffset, language, output);
+                pchInputs[language] = output;
+            }
         }
-    }
+    };
 
-    std::string cppPchFlags;
-    std::string objCppPchFlags;
-    std::vector<std::filesystem::path> pchInputs;
-    if(!importPch.value().empty())
+    auto buildPch = resolvedSettings.buildPch.value();
+    auto importPch = resolvedSettings.importPch.value();
+    if(!buildPch.empty() && buildPch != importPch)
+    {
+        addPch(buildPch, false);
+    }
+    if(!importPch.empty())
     {
-        auto input = dataDir / std::filesystem::path("pch") / (importPch.value().relative_path().string() + ".pch");
-        auto inputStr = (pathOffset / input).string();
-        cppPchFlags += " -Xclang -include-pch -Xclang " + inputStr;
-        pchInputs.push_back(input);
-
-        auto inputObjCpp = dataDir / std::filesystem::path("pch") / (importPch.value().relative_path().string() + ".pchmm");
-        auto inputObjCppStr = (pathOffset / inputObjCpp).string();
-        objCppPchFlags += " -Xclang -include-pch -Xclang " + inputObjCppStr;
-        pchInputs.push_back(inputObjCpp);
+        addPch(importPch, true);
     }
 
-    std::unordered_map<Language, std::string, std::hash<StringId>> commonCompilerFlags;
-    auto getCommonCompilerCommand = [&](Language language) -> const std::string& {
+    std::unordered_map<Language, StringId, std::hash<StringId>> commonCompilerFlags;
+    auto getCommonCompilerCommand = [&](Language language) -> StringId {
         auto it = commonCompilerFlags.find(language);
         if(it != commonCompilerFlags.end())
         {
@@ -287,17 +373,13 @@ std::vector<std::filesystem::path> GccLikeToolchainProvider::process(Project& pr
         auto flags = str::quote(getCompiler(project, resolvedSettings, pathOffset, language)) +
                         getCommonCompilerFlags(project, resolvedSettings, pathOffset, language, false);
         
-        // TODO: Do PCH management less hard coded, and only build PCHs for different languages if needed
-        if(language == lang::Cpp)
+        auto pchIt = pchFlags.find(language);
+        if(pchIt != pchFlags.end())
         {
-            flags += cppPchFlags;
-        }
-        else if(language == lang::ObjectiveCpp)
-        {
-            flags += objCppPchFlags;
+            flags += pchIt->second;
         }
 
-        return commonCompilerFlags[language] = flags;
+        return commonCompilerFlags[language] = StringId(std::move(flags));
     };
 
     auto linkerCommand = str::quote(getLinker(project, resolvedSettings, pathOffset)) + getCommonLinkerFlags(project, resolvedSettings, pathOffset);
@@ -312,14 +394,19 @@ std::vector<std::filesystem::path> GccLikeToolchainProvider::process(Project& pr
         }
 
         auto inputStr = (pathOffset / input.path).string();
-        auto output = dataDir / std::filesystem::path("obj") / project.name / (input.path.relative_path().string() + ".o");
+        auto commandPrefix = getCommonCompilerCommand(language);
+        auto output = getObjectPath(project, resolvedSettings, input.path, commandPrefix, inputStr);
         auto outputStr = (pathOffset / output).string();
 
         CommandEntry command;
-        command.command = getCommonCompilerCommand(language) + 
-                            getCompilerFlags(project, resolvedSettings, pathOffset, language, inputStr, outputStr);
+        command.commandPrefix = commandPrefix;
+        command.command = getCompilerFlags(project, resolvedSettings, pathOffset, language, inputStr, outputStr);
         command.inputs = { input.path };
-        command.inputs.insert(command.inputs.end(), pchInputs.begin(), pchInputs.end());
+        auto pchInput = pchInputs.find(language);
+        if(pchInput != pchInputs.end())
+        {
+            command.inputs.push_back(pchInput->second);
+        }
         command.outputs = { output };
         command.workingDirectory = workingDir;
         command.depFile = output.string() + ".d";
@@ -333,12 +420,29 @@ std::vector<std::filesystem::path> GccLikeToolchainProvider::process(Project& pr
 
     if(!linker.empty())
     {
+        // Shared libraries are linked by path, but dependents only depend on
+        // their interface stubs, which change less often than the libraries.
+        std::vector<std::filesystem::path> dependencyInputs;
         if(project.type != StaticLib)
         {
-            for(auto& output : resolvedSettings.ext<GccInternal>().linkedOutputs)
+            auto& internal = resolvedSettings.ext<GccInternal>();
+            for(auto& output : internal.linkedOutputs)
             {
                 linkerInputs.push_back(output);
             }
+            dependencyInputs = linkerInputs;
+            for(auto& sharedLib : internal.linkedSharedLibs)
+            {
+                linkerInputs.push_back(sharedLib);
+            }
+            for(auto& interface : internal.linkedInterfaces)
+            {
+                dependencyInputs.push_back(interface);
+            }
+        }
+        else
+        {
+            dependencyInputs = linkerInputs;
         }
 
         std::vector<std::string> linkerInputStrs;
@@ -361,7 +465,7 @@ std::vector<std::filesystem::path> GccLikeToolchainProvider::process(Project& pr
 
         CommandEntry command;
         command.command = linkerCommand + getLinkerFlags(project, resolvedSettings, pathOffset, linkerInputStrs, outputStr);
-        command.inputs = std::move(linkerInputs);
+        command.inputs = std::move(dependencyInputs);
         command.outputs = { output };
         command.workingDirectory = workingDir;
         command.description = "Linking " + project.name + ": " + output.string();
@@ -373,6 +477,21 @@ std::vector<std::filesystem::path> GccLikeToolchainProvider::process(Project& pr
         {
             project(PublicOnly, config).ext<GccInternal>().linkedOutputs += output;
         }
+        else if(project.type == SharedLib)
+        {
+            project(PublicOnly, config).ext<GccInternal>().linkedSharedLibs += output;
+
+            auto interfaceStub = getInterfaceStubCommand(project, resolvedSettings, pathOffset, output, workingDir);
+            if(!interfaceStub.outputs.empty())
+            {
+                project(PublicOnly, config).ext<GccInternal>().linkedInterfaces += interfaceStub.outputs.front();
+                resolvedSettings.commands += std::move(interfaceStub);
+            }
+            else
+            {
+                project(PublicOnly, config).ext<GccInternal>().linkedInterfaces += output;
+            }
+        }
     }
 
     return outputs;
@@ -0,0 +1,219 @@
+#include "includescanner.h"
+#include "modules/language.h"
+#include "util/file.h"
+#include "util/process.h"
+#include "util/profile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+
+bool IncludeScanner::isScannable(const std::filesystem::path& path)
+{
+    auto extension = path.extension().string();
+    if(extension == ".h" || extension == ".hh" || extension == ".hpp" || extension == ".hxx" || extension == ".inl")
+    {
+        return true;
+    }
+    return Language::getByExtension(extension) != lang::None;
+}
+
+size_t IncludeScanner::getPathSet(const std::vector<std::filesystem::path>& includePaths)
+{
+    std::string key;
+    for(auto& path : includePaths)
+    {
+        key += path.string();
+        key.push_back('\0');
+    }
+
+    std::scoped_lock lock(_mutex);
+    auto it = _pathSetIndices.find(key);
+    if(it != _pathSetIndices.end())
+    {
+        return it->second;
+    }
+
+    std::vector<std::filesystem::path> pathSet;
+    for(auto& path : includePaths)
+    {
+        pathSet.push_back(std::filesystem::absolute(path).lexically_normal());
+    }
+    _pathSets.push_back(std::move(pathSet));
+    _pathSetIndices.insert({ std::move(key), _pathSets.size()-1 });
+    return _pathSets.size()-1;
+}
+
+const std::vector<IncludeScanner::Include>& IncludeScanner::getIncludes(const std::string& file)
+{
+    {
+        std::scoped_lock lock(_mutex);
+        auto it = _includes.find(file);
+        if(it != _includes.end())
+        {
+            return it->second;
+        }
+    }
+
+    // Parsing happens outside the lock. Should two threads race on the same
+    // file, the first result wins and the other is discarded.
+    std::vector<Include> includes;
+    file::MappedFile data(file);
+    parseIncludeDirectives(data.view(), [&](std::string_view name, bool quoted)
+    {
+        includes.push_back({ std::string(name), quoted });
+    });
+
+    std::scoped_lock lock(_mutex);
+    return _includes.emplace(file, std::move(includes)).first->second;
+}
+
+bool IncludeScanner::exists(const std::string& path)
+{
+    {
+        std::scoped_lock lock(_mutex);
+        auto it = _exists.find(path);
+        if(it != _exists.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::error_code ec;
+    bool result = std::filesystem::is_regular_file(path, ec);
+
+    std::scoped_lock lock(_mutex);
+    return _exists.emplace(path, result).first->second;
+}
+
+const std::vector<std::string>& IncludeScanner::getResolvedIncludes(const std::string& file, size_t pathSet)
+{
+    std::string key = file;
+    key.push_back('\0');
+    key += std::to_string(pathSet);
+    {
+        std::scoped_lock lock(_mutex);
+        auto it = _resolvedIncludes.find(key);
+        if(it != _resolvedIncludes.end())
+        {
+            return it->second;
+        }
+    }
+
+    const std::vector<std::filesystem::path>* includePaths;
+    {
+        std::scoped_lock lock(_mutex);
+        includePaths = &_pathSets[pathSet];
+    }
+
+    std::vector<std::string> resolved;
+    auto directory = std::filesystem::path(file).parent_path();
+    for(auto& include : getIncludes(file))
+    {
+        std::filesystem::path name = include.name;
+        if(name.is_absolute())
+        {
+            auto candidate = name.lexically_normal().string();
+            if(exists(candidate))
+            {
+                resolved.push_back(std::move(candidate));
+            }
+            continue;
+        }
+
+        if(include.quoted)
+        {
+            auto candidate = (directory / name).lexically_normal().string();
+            if(exists(candidate))
+            {
+                resolved.push_back(std::move(candidate));
+                continue;
+            }
+        }
+
+        for(auto& includePath : *includePaths)
+        {
+            auto candidate = (includePath / name).lexically_normal().string();
+            if(exists(candidate))
+            {
+                resolved.push_back(std::move(candidate));
+                break;
+            }
+        }
+    }
+
+    std::scoped_lock lock(_mutex);
+    return _resolvedIncludes.emplace(std::move(key), std::move(resolved)).first->second;
+}
+
+const std::vector<std::filesystem::path>& IncludeScanner::scan(const std::filesystem::path& source, const std::vector<std::filesystem::path>& includePaths)
+{
+    size_t pathSet = getPathSet(includePaths);
+    std::string root = std::filesystem::absolute(source).lexically_normal().string();
+
+    std::string key = root;
+    key.push_back('\0');
+    key += std::to_string(pathSet);
+    {
+        std::scoped_lock lock(_mutex);
+        auto it = _closures.find(key);
+        if(it != _closures.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::vector<std::filesystem::path> closure;
+    std::unordered_set<std::string> visited{ root };
+    std::vector<std::string> pending{ root };
+    while(!pending.empty())
+    {
+        auto file = std::move(pending.back());
+        pending.pop_back();
+
+        for(auto& include : getResolvedIncludes(file, pathSet))
+        {
+            if(visited.insert(include).second)
+            {
+                closure.push_back(include);
+                pending.push_back(include);
+            }
+        }
+    }
+
+    std::scoped_lock lock(_mutex);
+    return _closures.emplace(std::move(key), std::move(closure)).first->second;
+}
+
+std::vector<std::vector<std::filesystem::path>> IncludeScanner::scan(const std::vector<Request>& requests, size_t threadCount)
+{
+    std::vector<std::vector<std::filesystem::path>> results(requests.size());
+    if(threadCount == 0)
+    {
+        threadCount = process::availableConcurrency();
+    }
+    threadCount = std::min(threadCount, requests.size());
+
+    std::atomic<size_t> next = 0;
+    auto worker = [&](){
+        profile::Scope scope("Scan includes");
+        for(size_t index = next++; index < requests.size(); index = next++)
+        {
+            results[index] = scan(requests[index].source, requests[index].includePaths);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < threadCount; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    return results;
+}
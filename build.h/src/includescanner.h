@@ -0,0 +1,236 @@
+#pragma once
+
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "dependencyparser.h"
+
+// Finds the #include directives in C-family source, calling callable with the
+// header name and whether it was quoted. This is not a preprocessor; macros
+// aren't expanded and conditionals are handled conservatively, so headers in
+// every branch are reported except those in "#if 0" blocks. Comments, string
+// literals and raw string literals are skipped.
+template<typename Callable>
+void parseIncludeDirectives(std::string_view data, Callable callable)
+{
+    struct Conditional
+    {
+        bool parentDead;
+        bool dead;
+    };
+    std::vector<Conditional> conditionals;
+    auto active = [&](){
+        return conditionals.empty() || (!conditionals.back().parentDead && !conditionals.back().dead);
+    };
+
+    const size_t size = data.size();
+    size_t pos = 0;
+    bool lineStart = true;
+
+    auto isSpace = [](char c){
+        return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    };
+    auto skipSpace = [&](){
+        while(pos < size && (isSpace(data[pos]) || (data[pos] == '\\' && pos+1 < size && data[pos+1] == '\n')))
+        {
+            pos += data[pos] == '\\' ? 2 : 1;
+        }
+    };
+    auto skipLine = [&](){
+        pos = findAnyOf<'\n'>(data, pos);
+        if(pos == std::string_view::npos)
+        {
+            pos = size;
+        }
+    };
+
+    auto readDirective = [&](){
+        skipSpace();
+        size_t start = pos;
+        while(pos < size && (std::isalnum((unsigned char)data[pos]) || data[pos] == '_'))
+        {
+            ++pos;
+        }
+        auto name = data.substr(start, pos-start);
+        skipSpace();
+
+        if(name == "include" || name == "import" || name == "include_next")
+        {
+            if(pos >= size || (data[pos] != '"' && data[pos] != '<'))
+            {
+                // Computed includes can't be resolved without a preprocessor
+                return;
+            }
+            char terminator = data[pos] == '"' ? '"' : '>';
+            size_t nameStart = ++pos;
+            while(pos < size && data[pos] != terminator && data[pos] != '\n')
+            {
+                ++pos;
+            }
+            if(pos < size && data[pos] == terminator)
+            {
+                if(active() && pos > nameStart)
+                {
+                    callable(data.substr(nameStart, pos-nameStart), terminator == '"');
+                }
+                ++pos;
+            }
+        }
+        else if(name == "if" || name == "ifdef" || name == "ifndef")
+        {
+            bool dead = false;
+            if(name == "if")
+            {
+                size_t exprStart = pos;
+                while(pos < size && data[pos] != '\n' && data[pos] != '/')
+                {
+                    ++pos;
+                }
+                auto expr = data.substr(exprStart, pos-exprStart);
+                while(!expr.empty() && isSpace(expr.back()))
+                {
+                    expr.remove_suffix(1);
+                }
+                dead = expr == "0";
+            }
+            conditionals.push_back({ !active(), dead });
+        }
+        else if(name == "elif" || name == "else" || name == "elifdef" || name == "elifndef")
+        {
+            // Whatever the condition, an alternative to "#if 0" may be taken
+            if(!conditionals.empty())
+            {
+                conditionals.back().dead = false;
+            }
+        }
+        else if(name == "endif")
+        {
+            if(!conditionals.empty())
+            {
+                conditionals.pop_back();
+            }
+        }
+    };
+
+    while(pos < size)
+    {
+        char c = data[pos];
+        if(c == '\n')
+        {
+            lineStart = true;
+            ++pos;
+            continue;
+        }
+        if(isSpace(c))
+        {
+            ++pos;
+            continue;
+        }
+        if(c == '/' && pos+1 < size && data[pos+1] == '*')
+        {
+            pos = data.find("*/", pos+2);
+            pos = pos == std::string_view::npos ? size : pos+2;
+            continue;
+        }
+        if(c == '/' && pos+1 < size && data[pos+1] == '/')
+        {
+            skipLine();
+            continue;
+        }
+        if(c == '#' && lineStart)
+        {
+            ++pos;
+            lineStart = false;
+            readDirective();
+            continue;
+        }
+        lineStart = false;
+
+        if(c == '"' && pos > 0 && data[pos-1] == 'R')
+        {
+            size_t delimiterStart = pos+1;
+            size_t open = data.find('(', delimiterStart);
+            if(open == std::string_view::npos)
+            {
+                break;
+            }
+            std::string terminator = ")";
+            terminator.append(data.data() + delimiterStart, open - delimiterStart);
+            terminator.push_back('"');
+            pos = data.find(terminator, open+1);
+            pos = pos == std::string_view::npos ? size : pos + terminator.size();
+            continue;
+        }
+        if(c == '"' || c == '\'')
+        {
+            // Unterminated literals, like digit separators mistaken for
+            // character literals, only swallow the rest of the line.
+            ++pos;
+            while(pos < size && data[pos] != c && data[pos] != '\n')
+            {
+                pos += (data[pos] == '\\' && pos+1 < size) ? 2 : 1;
+            }
+            if(pos < size && data[pos] == c)
+            {
+                ++pos;
+            }
+            continue;
+        }
+
+        pos = findAnyOf<'\n', '/', '"', '\''>(data, pos+1);
+        if(pos == std::string_view::npos)
+        {
+            pos = size;
+        }
+    }
+}
+
+// Discovers the headers a source file depends on without running the compiler,
+// for actions that have no dependency file yet. Includes are resolved against
+// the directory of the including file (for quoted includes) and the given
+// include paths; headers that can't be found, like system headers, are
+// ignored. Results are memoized per file and include path set, and the scanner
+// can be shared between threads.
+class IncludeScanner
+{
+public:
+    struct Request
+    {
+        std::filesystem::path source;
+        std::vector<std::filesystem::path> includePaths;
+    };
+
+    // True for files the scanner understands, i.e. C-family sources and headers.
+    static bool isScannable(const std::filesystem::path& path);
+
+    // All headers transitively included by source, as normalized paths.
+    const std::vector<std::filesystem::path>& scan(const std::filesystem::path& source, const std::vector<std::filesystem::path>& includePaths);
+
+    // Scans several sources on a pool of threads. The results are in request order.
+    std::vector<std::vector<std::filesystem::path>> scan(const std::vector<Request>& requests, size_t threadCount = 0);
+
+private:
+    struct Include
+    {
+        std::string name;
+        bool quoted;
+    };
+
+    size_t getPathSet(const std::vector<std::filesystem::path>& includePaths);
+    const std::vector<Include>& getIncludes(const std::string& file);
+    const std::vector<std::string>& getResolvedIncludes(const std::string& file, size_t pathSet);
+    bool exists(const std::string& path);
+
+    std::mutex _mutex;
+    std::deque<std::vector<std::filesystem::path>> _pathSets;
+    std::unordered_map<std::string, size_t> _pathSetIndices;
+    std::unordered_map<std::string, std::vector<Include>> _includes;
+    std::unordered_map<std::string, std::vector<std::string>> _resolvedIncludes;
+    std::unordered_map<std::string, std::vector<std::filesystem::path>> _closures;
+    std::unordered_map<std::string, bool> _exists;
+};
@@ -1,13 +1,20 @@
 #include "emitters/ninja.h"
+#include "util/profile.h"
 
 struct NinjaWriter
 {
-    std::ofstream _stream;
+    std::filesystem::path _path;
+    std::ostringstream _stream;
     NinjaWriter(std::filesystem::path path)
-        : _stream(path)
+        : _path(std::move(path))
     {
     }
 
+    void write(file::WriteBatch& batch)
+    {
+        batch.write(_path, _stream.str());
+    }
+
     void subninja(std::string_view name)
     {
         _stream << "subninja " << name << "\n";
@@ -18,7 +25,7 @@ struct NinjaWriter
         _stream << name << " = " << value << "\n";
     }
 
-    void rule(std::string_view name, std::string_view command, std::string_view depfile = {}, std::string_view deps = {}, std::string_view description = {}, bool generator = false)
+    void rule(std::string_view name, std::string_view command, std::string_view depfile = {}, std::string_view deps = {}, std::string_view description = {}, bool generator = false, bool restat = false)
     {
         _stream << "rule " << name << "\n";
         _stream << "  command = " << command << "\n";
@@ -38,6 +45,10 @@ struct NinjaWriter
         {
             _stream << "  generator = 1\n";
         }
+        if(restat)
+        {
+            _stream << "  restat = 1\n";
+        }
         _stream << "\n";
     }
 
@@ -93,10 +104,33 @@ void NinjaEmitter::emit(Environment& env)
 {
     auto projects = env.collectProjects();
 
+    // Unchanged files are left untouched, so ninja doesn't consider
+    // anything depending on them dirty.
+    file::WriteBatch batch(file::Durability::Synced);
+
+    // Callable actions are run by invoking the generator with the same
+    // configuration options as this invocation.
+    std::string actionArguments;
+    for(auto& arg : env.cliContext.allArguments)
+    {
+        for(auto argument : cli::Argument::globalList())
+        {
+            if(argument->tryExtractArgument(arg))
+            {
+                actionArguments += " " + str::quote(arg);
+                break;
+            }
+        }
+    }
+
     std::vector<std::filesystem::path> outputs;
     auto configs = env.collectConfigs();
     for(auto& config : configs)
     {
+        auto [generator, buildOutput] = createGeneratorProject(env, *targetPath);
+        auto generatorPath = env.configurationFile.parent_path() / buildOutput;
+        std::string actionCommand = str::quote(generatorPath.string()) + " action" + actionArguments;
+
         std::filesystem::path configTargetPath = *targetPath;
         if(!config.empty())
         {
@@ -106,10 +140,12 @@ void NinjaEmitter::emit(Environment& env)
 
         auto outputFile = configTargetPath / "build.ninja";
         NinjaWriter ninja(outputFile);
+        std::unordered_set<std::string> emittedOutputs;
 
+        profile::Scope scope("Emit projects", config);
         for(auto project : projects)
         {
-            auto outputName = emitProject(configTargetPath, *project, config, false);
+            auto outputName = emitProject(configTargetPath, *project, config, false, actionCommand, emittedOutputs, batch);
             if(!outputName.empty())
             {
                 ninja.subninja(outputName);
@@ -128,9 +164,12 @@ void NinjaEmitter::emit(Environment& env)
             }
         }
 
-        auto [generator, buildOutput] = createGeneratorProject(env, *targetPath);
         outputs.push_back("build.ninja");
         generatorDependencies.push_back(buildOutput);
+        if(!env.generatorModule.empty())
+        {
+            generatorDependencies.push_back(env.generatorModule);
+        }
 
         std::string argumentString;
         for(auto& arg : env.cliContext.allArguments)
@@ -138,16 +177,27 @@ void NinjaEmitter::emit(Environment& env)
             argumentString += " " + str::quote(arg);
         }
         
-        generator->commands += CommandEntry{ str::quote((env.configurationFile.parent_path() / buildOutput).string()) + argumentString, generatorDependencies, outputs, env.startupDir, {}, "Running build generator." };
-        auto outputName = emitProject(configTargetPath, *generator, "", true);
-        ninja.subninja(outputName);
+        generator->commands += CommandEntry{ str::quote(generatorPath.string()) + argumentString, generatorDependencies, outputs, env.startupDir, {}, "Running build generator." };
+        for(auto project : env.collectProjects({ generator }))
+        {
+            auto outputName = emitProject(configTargetPath, *project, "", project == generator, actionCommand, emittedOutputs, batch);
+            ninja.subninja(outputName);
+        }
+        ninja.write(batch);
     }
+
+    profile::Scope scope("Write build files");
+    batch.commit();
 }
 
-std::string NinjaEmitter::emitProject(const std::filesystem::path& root, Project& project, StringId config, bool generator)
+std::string NinjaEmitter::emitProject(const std::filesystem::path& root, Project& project, StringId config, bool generator, std::string_view actionCommand, std::unordered_set<std::string>& emittedOutputs, file::WriteBatch& batch)
 {
     auto resolved = project.resolve(config, OperatingSystem::current());
     resolved.dataDir = root;
+    // No sharedDataDir, as every configuration is a separate ninja build
+    // with its own log. Sharing an output between them would have each
+    // configuration rebuild it, and builds of different configurations
+    // run at the same time would race writing it.
 
 #if TODO
     {
@@ -197,7 +247,11 @@ std::string NinjaEmitter::emitProject(const std::filesystem::path& root, Project
         toolchain = defaultToolchain;
     }
 
-    auto toolchainOutputs = toolchain->process(project, resolved, config, root);
+    std::vector<std::filesystem::path> toolchainOutputs;
+    {
+        profile::Scope scope("Toolchain processing", project.name);
+        toolchainOutputs = toolchain->process(project, resolved, config, root);
+    }
     for(auto& output : toolchainOutputs)
     {
         projectOutputs.push_back((pathOffset / output).string());
@@ -210,11 +264,17 @@ std::string NinjaEmitter::emitProject(const std::filesystem::path& root, Project
         prologue += "cmd /c ";
     }*/
     prologue += "cd \"$cwd\" && ";
-    ninja.rule("command", prologue + "$cmd", "$depfile", "", "$desc", generator);
+    // The generator leaves unchanged build files untouched, so it needs restat
+    // to keep ninja from rerunning it.
+    ninja.rule("command", prologue + "$cmd", "$depfile", "", "$desc", generator, generator);
+    ninja.rule("restat_command", prologue + "$cmd", "$depfile", "", "$desc", false, true);
 
-    std::vector<std::string> generatorDep = { "_generator" };
+    std::vector<std::string> generatorDep = { std::string(generatorProjectName) };
     std::vector<std::string> emptyDep = {};
 
+    // Shared command prefixes are written once as variables
+    std::unordered_map<StringId, std::string> prefixVariables;
+
     for(auto& command : commands)
     {
         std::filesystem::path cwd = command.workingDirectory;
@@ -247,21 +307,54 @@ std::string NinjaEmitter::emitProject(const std::filesystem::path& root, Project
 
         projectOutputs.insert(projectOutputs.end(), outputStrs.begin(), outputStrs.end());
 
+        // Projects sharing objects emit the same command, which ninja only
+        // accepts once
+        if(!outputStrs.empty() && !emittedOutputs.insert(outputStrs.front()).second)
+        {
+            continue;
+        }
+
         std::string depfileStr;
         if(!command.depFile.empty())
         {
             depfileStr = (pathOffset / command.depFile).string();
         }
 
+        std::string callableCommand;
+        if(command.callable)
+        {
+            callableCommand = std::string(actionCommand) + " " + str::quote("--id=" + command.callable->id) + " " + str::quote("--version=" + command.callable->version);
+        }
+
+        std::string cmd;
+        if(command.callable)
+        {
+            cmd = callableCommand;
+        }
+        else if(!command.commandPrefix.empty())
+        {
+            auto& prefixVariable = prefixVariables[command.commandPrefix];
+            if(prefixVariable.empty())
+            {
+                prefixVariable = "cmdprefix" + std::to_string(prefixVariables.size());
+                ninja.variable(prefixVariable, command.commandPrefix);
+            }
+            cmd = "${" + prefixVariable + "}" + command.command;
+        }
+        else
+        {
+            cmd = command.command;
+        }
+
         std::vector<std::pair<std::string_view, std::string_view>> variables;
-        variables.push_back({"cmd", command.command});
+        variables.push_back({"cmd", cmd});
         variables.push_back({"cwd", cwdStr});
         variables.push_back({"depfile", depfileStr});
         if(!command.description.empty())
         {
             variables.push_back({"desc", command.description});
         }
-        ninja.build(outputStrs, "command", inputStrs, {}, project.name == "_generator" ? emptyDep : generatorDep, variables);
+        ninja.build(outputStrs, command.restat ? "restat_command" : "command", inputStrs, {}, isGeneratorProject(project) ? emptyDep : generatorDep, variables);
     }
 
     if(!projectOutputs.empty())
@@ -269,6 +362,8 @@ std::string NinjaEmitter::emitProject(const std::filesystem::path& root, Project
         ninja.build({ project.name }, "phony", projectOutputs);
     }
 
+    ninja.write(batch);
+
     return ninjaName;
 }
 
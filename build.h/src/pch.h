@@ -0,0 +1,31 @@
+// Headers used by most of build.h's own sources and by build configurations,
+// precompiled when building the generator.
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "core/environment.h"
+#include "core/project.h"
+#include "core/property.h"
+#include "core/stringid.h"
+#include "modules/command.h"
+#include "modules/toolchain.h"
+#include "util/cli.h"
+#include "util/commands.h"
+#include "util/file.h"
+#include "util/process.h"
+#include "util/string.h"
@@ -1,4 +1,7 @@
 #include "core/project.h"
+#include "util/profile.h"
+
+#include <cassert>
 
 Project::Project(std::string name, std::optional<ProjectType> type)
     : name(std::move(name))
@@ -10,8 +13,12 @@ Project::~Project()
 
 ProjectSettings Project::resolve(StringId configName, OperatingSystem targetOS)
 {
-    ProjectSettings result;
+    profile::Scope scope("Resolve settings", name);
+    // Resolved settings are built and thrown away for every project and
+    // configuration, so they share one arena that's released in one go.
+    ProjectSettings result(std::make_shared<std::pmr::monotonic_buffer_resource>());
     internalResolve(result, type, configName, targetOS, true);
+    result.evaluateDeferred();
     return result;
 }
 
@@ -85,6 +92,7 @@ ProjectSettings& ProjectSettings::operator +=(const ProjectSettings& other)
         }
         else
         {
+            ArenaScope arenaScope(_arena);
             _extensions.insert({extension.first, extension.second->clone()});
         }
     }
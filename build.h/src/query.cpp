@@ -1,14 +1,19 @@
 #include "emitters/query.h"
+#include "modules/toolchain.h"
+#include "toolchains/detected.h"
+#include "util/file.h"
+#include "util/profile.h"
+#include "dependencyparser.h"
+#include "includescanner.h"
 
 Query::Query()
     : Emitter("query", "Retrieve information about the build configuration.")
 {
-    arguments.erase(std::remove(arguments.begin(), arguments.end(), &targetPath), arguments.end());
 }
 
 void Query::emit(Environment& env)
 {
-    if(!listProjects && !listConfigs)
+    if(!listProjects && !listConfigs && !affectedFiles)
     {
         throw cli::argument_error("No query type specified.");  
     }
@@ -21,6 +26,10 @@ void Query::emit(Environment& env)
     {
         emitConfigs(env);
     };
+    if(affectedFiles)
+    {
+        emitAffected(env);
+    }
 }
 
 void Query::emitProjects(Environment& env)
@@ -42,4 +51,206 @@ void Query::emitConfigs(Environment& env)
     }            
 }
 
+void Query::emitAffected(Environment& env)
+{
+    auto normalize = [](const std::filesystem::path& base, const std::filesystem::path& path)
+    {
+        return StringId((base / path).lexically_normal().string());
+    };
+
+    std::vector<StringId> changedFiles;
+    {
+        std::string fileList;
+        if(std::string_view(*affectedFiles) == "-")
+        {
+            fileList.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+            std::replace(fileList.begin(), fileList.end(), '\n', ',');
+        }
+        else
+        {
+            fileList = *affectedFiles;
+        }
+
+        for(auto file : str::splitAll(fileList, ','))
+        {
+            file = str::trim(file);
+            if(!file.empty())
+            {
+                changedFiles.push_back(normalize(env.startupDir, file));
+            }
+        }
+    }
+
+    auto projects = env.collectProjects();
+    auto configs = env.collectConfigs();
+
+    if(selectedConfig)
+    {
+        if(std::find(configs.begin(), configs.end(), *selectedConfig) == configs.end())
+        {
+            throw std::runtime_error("Selected config '" + std::string(*selectedConfig) + "' has not been used in build configuration.");
+        }
+    }
+
+    struct AffectedCommand
+    {
+        Project* project;
+        std::vector<StringId> outputs;
+        bool affected = false;
+    };
+
+    std::set<Project*> affectedProjects;
+    auto absCwd = std::filesystem::absolute(std::filesystem::current_path());
+    for(auto config : configs)
+    {
+        if(selectedConfig && config != *selectedConfig)
+        {
+            continue;
+        }
+
+        auto root = configDataDir(*targetPath, config);
+        auto sharedRoot = sharedDataDir(*targetPath);
+
+        std::vector<AffectedCommand> commands;
+        std::unordered_map<StringId, std::vector<size_t>> consumers;
+        std::vector<IncludeScanner::Request> scanRequests;
+        std::vector<size_t> scanCommands;
+        for(auto project : projects)
+        {
+            if(!project->type)
+            {
+                continue;
+            }
+
+            auto resolved = project->resolve(config, OperatingSystem::current());
+            // The same directories as the builder, to find its dependency files
+            resolved.dataDir = root;
+            resolved.sharedDataDir = sharedRoot;
+
+            const ToolchainProvider* toolchain = resolved.toolchain;
+            if(!toolchain)
+            {
+                toolchain = defaultToolchain;
+            }
+            {
+                profile::Scope scope("Toolchain processing", project->name);
+                toolchain->process(*project, resolved, config, {});
+            }
+
+            for(auto& command : resolved.commands)
+            {
+                size_t index = commands.size();
+                auto cwd = absCwd / command.workingDirectory;
+
+                AffectedCommand affectedCommand{project};
+                for(auto& output : command.outputs)
+                {
+                    affectedCommand.outputs.push_back(normalize(absCwd, output));
+                }
+                commands.push_back(std::move(affectedCommand));
+
+                for(auto& input : command.inputs)
+                {
+                    consumers[normalize(absCwd, input)].push_back(index);
+                }
+
+                // Headers recorded by the last build, or found by scanning the
+                // sources for commands that haven't written a dependency file yet.
+                if(!command.depFile.empty())
+                {
+                    file::MappedFile data(command.depFile);
+                    if(data)
+                    {
+                        parseDependencyData(data.view(), [&](std::string_view path)
+                        {
+                            consumers[normalize(cwd, path)].push_back(index);
+                            return false;
+                        });
+                    }
+                    else
+                    {
+                        std::vector<std::filesystem::path> includePaths;
+                        for(auto& includePath : resolved.includePaths)
+                        {
+                            includePaths.push_back(absCwd / includePath);
+                        }
+
+                        auto sources = command.inputs;
+                        if(!resolved.importPch.value().empty())
+                        {
+                            sources.push_back(resolved.importPch.value());
+                        }
+                        for(auto& source : sources)
+                        {
+                            if(IncludeScanner::isScannable(source))
+                            {
+                                scanRequests.push_back({ absCwd / source, includePaths });
+                                scanCommands.push_back(index);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        IncludeScanner scanner;
+        auto scanResults = scanner.scan(scanRequests);
+        for(size_t i = 0; i < scanResults.size(); ++i)
+        {
+            for(auto& header : scanResults[i])
+            {
+                consumers[StringId(header.string())].push_back(scanCommands[i]);
+            }
+        }
+
+        std::vector<StringId> pending = changedFiles;
+        while(!pending.empty())
+        {
+            auto file = pending.back();
+            pending.pop_back();
+
+            auto it = consumers.find(file);
+            if(it == consumers.end())
+            {
+                continue;
+            }
+
+            for(auto index : it->second)
+            {
+                auto& command = commands[index];
+                if(command.affected)
+                {
+                    continue;
+                }
+                command.affected = true;
+                affectedProjects.insert(command.project);
+                pending.insert(pending.end(), command.outputs.begin(), command.outputs.end());
+            }
+        }
+    }
+
+    // Only list projects that won't be built anyway as a dependency of
+    // another listed project, so the result is the minimal set to pass
+    // back to the build.
+    std::set<Project*> coveredProjects;
+    for(auto project : affectedProjects)
+    {
+        for(auto dependency : env.collectProjects({ project }))
+        {
+            if(dependency != project)
+            {
+                coveredProjects.insert(dependency);
+            }
+        }
+    }
+
+    for(auto project : projects)
+    {
+        if(affectedProjects.count(project) && !coveredProjects.count(project))
+        {
+            std::cout << project->name << "\n";
+        }
+    }
+}
+
 Query Query::instance;
@@ -1,4 +1,8 @@
 #include "core/stringid.h"
+#include "util/memory.h"
+
+#include <mutex>
+#include <shared_mutex>
 
 // Transparent lookup in unordered_set is a C++20 feature
 // so we'll have to make do with this... thing.
@@ -81,6 +85,14 @@ static std::unordered_set<StringStorage, StringStorageHash>& getStorage()
     static std::unordered_set<StringStorage, StringStorageHash> storage;
     return storage;
 }
+
+// Strings may be interned from several threads, e.g. by a parallel configure.
+// Most lookups find an existing string, so they only need a shared lock.
+static std::shared_mutex& getStorageMutex()
+{
+    static std::shared_mutex mutex;
+    return mutex;
+}
 bool StringId::empty() const
 {
     return _cstr == nullptr || _cstr[0] == 0;
@@ -99,8 +111,20 @@ StringId::operator const char*() const
 }
 size_t StringId::getStorageSize()
 {
+    std::shared_lock lock(getStorageMutex());
     return getStorage().size();
 }
+size_t StringId::getStorageBytes()
+{
+    std::shared_lock lock(getStorageMutex());
+    auto& storage = getStorage();
+    size_t size = memory::hashTableSize(storage.size(), storage.bucket_count(), sizeof(StringStorage));
+    for(auto& entry : storage)
+    {
+        size += memory::heapSize(entry.str);
+    }
+    return size;
+}
 
 StringId StringId::get(std::string&& str)
 {
@@ -110,12 +134,20 @@ StringId StringId::get(std::string&& str)
     }
 
     auto& storage = getStorage();
-    auto it = storage.find(str);
-    if(it == storage.end())
     {
-        it = storage.insert(std::move(str)).first;
+        std::shared_lock lock(getStorageMutex());
+        auto it = storage.find(str);
+        if(it != storage.end())
+        {
+            StringId result;
+            result._cstr = it->c_str();
+            return result;
+        }
     }
 
+    std::unique_lock lock(getStorageMutex());
+    auto it = storage.insert(std::move(str)).first;
+
     StringId result;
     result._cstr = it->c_str();
     return result;
@@ -129,6 +161,18 @@ StringId StringId::get(std::string_view str)
     }
 
     auto& storage = getStorage();
+    {
+        std::shared_lock lock(getStorageMutex());
+        auto it = storage.find(str);
+        if(it != storage.end())
+        {
+            StringId result;
+            result._cstr = it->c_str();
+            return result;
+        }
+    }
+
+    std::unique_lock lock(getStorageMutex());
     auto it = storage.find(str);
     if(it == storage.end())
     {
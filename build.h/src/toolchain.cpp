@@ -0,0 +1,29 @@
+#include "core/project.h"
+#include "modules/toolchain.h"
+#include "modules/feature.h"
+#include "util/hash.h"
+
+#include <algorithm>
+
+std::filesystem::path ToolchainProvider::getObjectPath(Project& project, ProjectSettings& resolvedSettings, const std::filesystem::path& input, std::string_view commandPrefix, std::string_view inputStr)
+{
+    auto& features = resolvedSettings.features;
+    if(std::find(features.begin(), features.end(), feature::SharedObjects) == features.end())
+    {
+        return resolvedSettings.dataDir.value() / std::filesystem::path("obj") / project.name / (input.relative_path().string() + ".o");
+    }
+
+    // Configurations with the same effective command share the object too
+    auto objDir = resolvedSettings.sharedDataDir.value() / std::filesystem::path("obj");
+    if(resolvedSettings.sharedDataDir.value().empty())
+    {
+        objDir = resolvedSettings.dataDir.value() / std::filesystem::path("obj") / "_shared";
+    }
+
+    // The rest of the command line only depends on the input and output
+    std::string key(commandPrefix);
+    key += '\n';
+    key += inputStr;
+    auto commandHash = hash::toHex(hash::fingerprint(key)).substr(0, 16);
+    return objDir / commandHash / (input.filename().string() + ".o");
+}
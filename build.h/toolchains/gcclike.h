@@ -1,7 +1,9 @@
 #pragma once
 
 #include <filesystem>
+#include <mutex>
 #include <string>
+#include <string_view>
 
 #include "core/project.h"
 #include "modules/command.h"
@@ -28,11 +30,24 @@ struct GccLikeToolchainProvider : public ToolchainProvider
 
     GccLikeToolchainProvider(std::string name, std::string compiler, std::string linker, std::string archiver);
 
+    // Whether the compiler is clang rather than GCC, which differ in how
+    // precompiled headers are made and used. Detected by running it once.
+    bool isClang() const;
+
     virtual std::string getCompiler(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, Language language) const;
     virtual std::string getCommonCompilerFlags(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, Language language, bool pch) const;
     virtual std::string getCompilerFlags(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, Language language, const std::string& input, const std::string& output) const;
     virtual std::string getLinker(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset) const;
     virtual std::string getCommonLinkerFlags(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset) const;
     virtual std::string getLinkerFlags(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, const std::vector<std::string>& inputs, const std::string& output) const;
+    // Command writing a stub with the exported interface of a shared library,
+    // or an empty command if not supported.
+    virtual CommandEntry getInterfaceStubCommand(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, const std::filesystem::path& library, const std::filesystem::path& workingDir) const;
+    virtual std::filesystem::path getPchPath(Project& project, ProjectSettings& resolvedSettings, const std::filesystem::path& header, Language language, std::string_view commonFlags) const;
+    virtual std::string getPchImportFlags(Project& project, ProjectSettings& resolvedSettings, std::filesystem::path pathOffset, Language language, const std::filesystem::path& pch) const;
     std::vector<std::filesystem::path> process(Project& project, ProjectSettings& resolvedSettings, StringId config, const std::filesystem::path& workingDir) const override;
+
+private:
+    mutable std::once_flag _compilerDetected;
+    mutable bool _clang = false;
 };
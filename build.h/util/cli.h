@@ -25,6 +25,13 @@ struct Argument
 {
     virtual bool tryExtractArgument(std::string_view argStr) = 0;
 
+    // Returns how many arguments were used, to allow values in a separate
+    // argument following the option.
+    virtual size_t tryExtractArguments(std::string_view argStr, const std::string* nextArgStr)
+    {
+        return tryExtractArgument(argStr) ? 1 : 0;
+    }
+
     std::string example;
     std::string description;
 
@@ -71,14 +78,16 @@ struct BoolArgument : public Argument
 
 struct StringArgument : public Argument
 {
-    StringArgument(std::string name, std::string description, std::optional<std::string> defaultValue = {})
-        : StringArgument(Argument::globalList(), name, description, defaultValue)
+    StringArgument(std::string name, std::string description, std::optional<std::string> defaultValue = {}, std::string shortName = {})
+        : StringArgument(Argument::globalList(), name, description, defaultValue, shortName)
     { }
 
-    StringArgument(std::vector<cli::Argument*>& argumentList, std::string name, std::string description, std::optional<std::string> defaultValue = {})
+    // The optional short name allows "-<short> <value>" and "-<short><value>" as well.
+    StringArgument(std::vector<cli::Argument*>& argumentList, std::string name, std::string description, std::optional<std::string> defaultValue = {}, std::string shortName = {})
     {
         this->name = std::move(name);
-        this->example = "--" + this->name + "=<value>";
+        this->shortName = std::move(shortName);
+        this->example = (this->shortName.empty() ? "" : "-" + this->shortName + ", ") + "--" + this->name + "=<value>";
         this->description = std::move(description);
         
         value = std::move(defaultValue);
@@ -118,14 +127,67 @@ struct StringArgument : public Argument
         return true;        
     }
 
+    size_t tryExtractArguments(std::string_view argStr, const std::string* nextArgStr) override
+    {
+        if(shortName.empty() ||
+           argStr.size() < shortName.size() + 1 ||
+           argStr[0] != '-' ||
+           argStr.compare(1, shortName.size(), shortName) != 0)
+        {
+            return tryExtractArgument(argStr) ? 1 : 0;
+        }
+
+        argStr = argStr.substr(shortName.size() + 1);
+        if(!argStr.empty())
+        {
+            value = argStr;
+            return 1;
+        }
+
+        if(!nextArgStr)
+        {
+            throw argument_error("Expected value for option '-" + shortName + "'.");
+        }
+        value = *nextArgStr;
+        return 2;
+    }
+
     explicit operator bool() const { return value.has_value(); }
 
     StringId operator*() { return *value; }
 
     std::string name;
+    std::string shortName;
     std::optional<StringId> value;
 };
 
+// A string option that may also be given as a bare flag, e.g. "--<name>" as
+// well as "--<name>=<value>", which sets the implicit value.
+struct FlagOrStringArgument : public StringArgument
+{
+    FlagOrStringArgument(std::vector<cli::Argument*>& argumentList, std::string name, std::string description, std::string implicitValue)
+        : StringArgument(argumentList, std::move(name), std::move(description))
+        , implicitValue(std::move(implicitValue))
+    {
+        this->example = "--" + this->name + "[=<value>]";
+    }
+
+    bool tryExtractArgument(std::string_view argStr) override
+    {
+        if(argStr.size() == name.size() + 2 &&
+           argStr.substr(0, 2) == "--" &&
+           argStr.substr(2) == name)
+        {
+            value = implicitValue;
+            return true;
+        }
+
+        return StringArgument::tryExtractArgument(argStr);
+    }
+
+    std::string implicitValue;
+};
+
 struct PathArgument : public Argument
 {
     PathArgument(std::string name, std::string description, std::optional<std::filesystem::path> defaultValue = {})
@@ -193,7 +255,7 @@ struct Context
         , allArguments(std::move(arguments))
     {
         unusedArguments = allArguments;
-        if(!unusedArguments.empty() && !str::startsWith(unusedArguments[0], "--"))
+        if(!unusedArguments.empty() && !str::startsWith(unusedArguments[0], "-"))
         {
             action = unusedArguments[0];
             unusedArguments.erase(unusedArguments.begin());
@@ -213,12 +275,11 @@ struct Context
         auto it = unusedArguments.begin();
         while(it != unusedArguments.end())
         {
-            auto& argStr = *it;
-            bool found = false;
-            if(argument->tryExtractArgument(argStr))
+            auto next = it + 1;
+            size_t used = argument->tryExtractArguments(*it, next != unusedArguments.end() ? &*next : nullptr);
+            if(used > 0)
             {
-                found = true;
-                unusedArguments.erase(it);
+                unusedArguments.erase(it, it + used);
                 return true;
             }
             ++it;
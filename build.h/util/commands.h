@@ -24,7 +24,24 @@ inline CommandEntry chain(const std::vector<CommandEntry>& commands, std::string
             throw std::invalid_argument("Can't chain commands with different working directories.");
         }        
 
-        result.command += " && " + command.command;
+        if(result.callable || command.callable)
+        {
+            throw std::invalid_argument("Can't chain callable actions.");
+        }
+
+        // The first prefix can stay shared, the rest are spelled out
+        result.command += " && " + command.commandLine();
+
+        // The chain can only be performed as builtins if every part can
+        if(result.builtins.empty() || command.builtins.empty())
+        {
+            result.builtins.clear();
+        }
+        else
+        {
+            result.builtins.insert(result.builtins.end(), command.builtins.begin(), command.builtins.end());
+        }
+
         result.inputs.insert(result.inputs.end(), command.inputs.begin(), command.inputs.end());
         result.outputs.insert(result.outputs.end(), command.outputs.begin(), command.outputs.end());
 
@@ -60,6 +77,7 @@ inline CommandEntry mkdir(std::filesystem::path dir)
     {
         commandEntry.command = "mkdir -p " + dirStr + "";
     }
+    commandEntry.builtins = { { BuiltinStep::Mkdir, {}, dir } };
     commandEntry.description += "Creating directory '" + dir.string() + "'";
     return commandEntry;
 }
@@ -80,6 +98,7 @@ inline CommandEntry copy(std::filesystem::path from, std::filesystem::path to)
     {
         commandEntry.command = "cp " + fromStr + " " + toStr + "";
     }
+    commandEntry.builtins = { { BuiltinStep::Copy, from, to } };
 
     auto toParent = to.parent_path();
     if(!toParent.empty())
@@ -107,6 +126,7 @@ inline CommandEntry move(std::filesystem::path from, std::filesystem::path to)
     {
         commandEntry.command = "mv " + fromStr + " " + toStr + " && touch " + toStr;
     }
+    commandEntry.builtins = { { BuiltinStep::Move, from, to }, { BuiltinStep::Touch, {}, to } };
 
     auto toParent = to.parent_path();
     if(!toParent.empty())
@@ -118,4 +138,57 @@ inline CommandEntry move(std::filesystem::path from, std::filesystem::path to)
     return commandEntry;
 }
 
+// Creates a command that runs function in process. The id must be unique and
+// stay the same between generator invocations, and the version should change
+// whenever the function starts producing different outputs.
+inline CommandEntry callable(std::string id, std::string version, std::vector<std::filesystem::path> inputs, std::vector<std::filesystem::path> outputs, CallableAction::Function function, std::string description = {})
+{
+    if(id.empty())
+    {
+        throw std::invalid_argument("Callable actions need an id.");
+    }
+
+    auto action = std::make_shared<CallableAction>();
+    action->id = std::move(id);
+    action->version = std::move(version);
+    action->inputs = std::move(inputs);
+    action->outputs = std::move(outputs);
+    action->function = std::move(function);
+    CallableActions::install(action);
+
+    CommandEntry commandEntry;
+    commandEntry.command = "callable " + action->id + " " + action->version;
+    commandEntry.inputs = action->inputs;
+    commandEntry.outputs = action->outputs;
+    commandEntry.description = description.empty() ? "Running '" + action->id + "'" : std::move(description);
+    commandEntry.callable = std::move(action);
+    return commandEntry;
 }
+
+inline CommandEntry touch(std::filesystem::path path)
+{
+    CommandEntry commandEntry;
+    commandEntry.outputs = { path };
+
+    auto pathStr = str::quote(path.make_preferred().string());
+    if(OperatingSystem::current() == Windows)
+    {
+        commandEntry.command = "(if not exist " + pathStr + " type nul > " + pathStr + ") && copy /b " + pathStr + " +,,";
+    }
+    else
+    {
+        commandEntry.command = "touch " + pathStr;
+    }
+    commandEntry.builtins = { { BuiltinStep::Touch, {}, path } };
+
+    auto parent = path.parent_path();
+    if(!parent.empty())
+    {
+        commandEntry = chain({mkdir(parent), commandEntry});
+    }
+
+    commandEntry.description = "Touching '" + path.string() + "'";
+    return commandEntry;
+}
+
+}
\ No newline at end of file
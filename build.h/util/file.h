@@ -1,125 +1,510 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+
+#if !_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 namespace file
 {
 
-inline std::string read(std::filesystem::path path)
+// Read-only view of the contents of a file. Files are memory mapped when
+// possible, but small files and files that can't be mapped (e.g. on special
+// file systems that don't report a size) are read into a buffer instead.
+struct MappedFile
 {
-    std::ifstream stream(path);
-    if(!stream)
-    {
-        return {};
-    }
-    
-    stream.seekg(0, std::ios_base::end);
-    size_t size = stream.tellg();
-    stream.seekg(0, std::ios_base::beg);
+    // Files smaller than this are cheaper to read than to map
+    static constexpr size_t mapThreshold = 16 * 1024;
 
-    std::string buffer;
-    buffer.resize(size);
-    stream.read(buffer.data(), size);
-    return buffer;
-}
+    MappedFile() = default;
 
-inline bool write(std::filesystem::path path, const std::string& data)
-{
-    bool upToDate = false;
-    std::error_code ec;
-    size_t fileSize = std::filesystem::file_size(path, ec);
-    if(!ec && fileSize == data.size())
-    {
-        std::ifstream inputStream(path);
-        std::array<char, 2048> buffer;
-        size_t pos = 0;
-        while(inputStream.good())
-        {
-            size_t chunk = std::min(buffer.size(), fileSize - pos);
-            inputStream.read(buffer.data(), chunk);
-            if(!inputStream)
+    MappedFile(const std::filesystem::path& path)
+    {
+#if _WIN32
+        std::ifstream stream(path, std::ios_base::binary);
+        if(!stream)
+        {
+            return;
+        }
+        _buffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        _valid = true;
+#else
+        int fileDescriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fileDescriptor < 0)
+        {
+            return;
+        }
+
+        struct stat statData;
+        if(fstat(fileDescriptor, &statData) == 0 &&
+           S_ISREG(statData.st_mode) &&
+           (size_t)statData.st_size >= mapThreshold)
+        {
+            size_t size = (size_t)statData.st_size;
+            void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+            if(ptr != MAP_FAILED)
             {
-                break;
+                madvise(ptr, size, MADV_SEQUENTIAL);
+                madvise(ptr, size, MADV_WILLNEED);
+                _mapped = static_cast<const char*>(ptr);
+                _mappedSize = size;
+                _valid = true;
+                close(fileDescriptor);
+                return;
             }
-            if(memcmp(data.data() + pos, buffer.data(), chunk) != 0)
+        }
+
+        std::array<char, 16 * 1024> buffer;
+        while(true)
+        {
+            auto bytesRead = ::read(fileDescriptor, buffer.data(), buffer.size());
+            if(bytesRead < 0)
             {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
                 break;
             }
-            pos += chunk;
-            if(pos == fileSize)
+            if(bytesRead == 0)
             {
-                return false;
+                _valid = true;
+                break;
             }
+            _buffer.append(buffer.data(), bytesRead);
         }
+        close(fileDescriptor);
+#endif
     }
 
-    if(path.has_parent_path())
+    MappedFile(MappedFile&& other)
+        : _mapped(other._mapped)
+        , _mappedSize(other._mappedSize)
+        , _buffer(std::move(other._buffer))
+        , _valid(other._valid)
     {
-        std::filesystem::create_directories(path.parent_path());
+        other._mapped = nullptr;
+        other._mappedSize = 0;
+        other._valid = false;
     }
-    std::ofstream stream(path);
-    stream.write(data.data(), data.size());
-    return true;
-}
 
-#if 0
-struct MappedFile
-{
-    MappedFile(MappedFile&& other)
-        : data(other.data)
-        , size(other.size)
+    MappedFile& operator=(MappedFile&& other)
     {
-        data = other.data;
-        size = other.size;
-        other.data = nullptr;
-    } 
+        if(this != &other)
+        {
+            unmap();
+            _mapped = other._mapped;
+            _mappedSize = other._mappedSize;
+            _buffer = std::move(other._buffer);
+            _valid = other._valid;
+            other._mapped = nullptr;
+            other._mappedSize = 0;
+            other._valid = false;
+        }
+        return *this;
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
 
     ~MappedFile()
     {
-        if(data)
+        unmap();
+    }
+
+    // False if the file couldn't be opened
+    explicit operator bool() const { return _valid; }
+
+    std::string_view view() const
+    {
+        if(_mapped)
+        {
+            return std::string_view(_mapped, _mappedSize);
+        }
+        return _buffer;
+    }
+
+    const char* data() const { return view().data(); }
+    size_t size() const { return view().size(); }
+    bool empty() const { return view().empty(); }
+
+private:
+    void unmap()
+    {
+#if !_WIN32
+        if(_mapped)
         {
-            munmap(data, size);
+            munmap(const_cast<char*>(_mapped), _mappedSize);
+            _mapped = nullptr;
         }
+#endif
     }
+
+    const char* _mapped = nullptr;
+    size_t _mappedSize = 0;
+    std::string _buffer;
+    bool _valid = false;
+};
+
+inline std::string read(std::filesystem::path path)
+{
+    return std::string(MappedFile(path).view());
 }
 
-template<typename T = char>
-std::unique_ptr<T> map(const std::filesystem::path& path)
+enum class Durability
 {
-    template<typename T>
-    struct Destructor
+    // Files are replaced atomically, but may be lost on a system crash
+    Atomic,
+    // Files and directory entries are flushed to disk when the batch is committed
+    Synced,
+};
+
+// Writes files by writing to a temporary file next to the target and renaming
+// it into place, so an interrupted write never leaves a partially written file.
+// Files whose contents are unchanged are left untouched. With synced durability,
+// each affected directory is flushed once on commit rather than once per file.
+struct WriteBatch
+{
+    WriteBatch(Durability durability = Durability::Atomic)
+        : _durability(durability)
+    { }
+
+    WriteBatch(const WriteBatch& other) = delete;
+    WriteBatch& operator=(const WriteBatch& other) = delete;
+
+    ~WriteBatch()
+    {
+        commit();
+    }
+
+    // Returns true if the file was written, false if it was already up to date
+    bool write(const std::filesystem::path& path, std::string_view data)
     {
-        Destructor(T callable) : _callable(callable) {}
-        ~Destructor() { _callable(); }
+        std::error_code ec;
+        size_t fileSize = std::filesystem::file_size(path, ec);
+        if(!ec && fileSize == data.size())
+        {
+            MappedFile existing(path);
+            if(existing && existing.view() == data)
+            {
+                return false;
+            }
+        }
 
-    private:
-        T _callable;
-    };
+        auto parentPath = path.parent_path();
+        if(!parentPath.empty())
+        {
+            std::filesystem::create_directories(parentPath);
+        }
 
-    int fileDescriptor = open(path.c_str(), O_RDONLY);
-    if(fileDescriptor < 0)
+        static std::atomic<unsigned int> tempCounter = 0;
+        auto tempPath = path;
+#if _WIN32
+        tempPath += "." + std::to_string(tempCounter++) + ".tmp";
+        {
+            std::ofstream stream(tempPath, std::ios_base::binary);
+            stream.write(data.data(), data.size());
+            if(!stream)
+            {
+                throw std::runtime_error("Failed to write '" + tempPath.string() + "'.");
+            }
+        }
+#else
+        tempPath += "." + std::to_string(getpid()) + "." + std::to_string(tempCounter++) + ".tmp";
+        int fileDescriptor = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if(fileDescriptor < 0)
+        {
+            throw std::runtime_error("Failed to open '" + tempPath.string() + "' for writing.");
+        }
+
+        // The replaced file keeps its permissions, e.g. for generated scripts
+        struct stat statData;
+        if(stat(path.c_str(), &statData) == 0)
+        {
+            fchmod(fileDescriptor, statData.st_mode & 07777);
+        }
+
+        size_t written = 0;
+        while(written < data.size())
+        {
+            auto result = ::write(fileDescriptor, data.data() + written, data.size() - written);
+            if(result < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                close(fileDescriptor);
+                std::filesystem::remove(tempPath, ec);
+                throw std::runtime_error("Failed to write '" + tempPath.string() + "'.");
+            }
+            written += result;
+        }
+
+        if(_durability == Durability::Synced)
+        {
+            fsync(fileDescriptor);
+        }
+        close(fileDescriptor);
+#endif
+
+        std::filesystem::rename(tempPath, path, ec);
+        if(ec)
+        {
+            std::filesystem::remove(tempPath, ec);
+            throw std::runtime_error("Failed to replace '" + path.string() + "'.");
+        }
+
+        if(_durability == Durability::Synced)
+        {
+            std::scoped_lock lock(_mutex);
+            _directories.insert(parentPath.empty() ? std::filesystem::path(".") : parentPath);
+        }
+
+        return true;
+    }
+
+    void commit()
+    {
+        std::scoped_lock lock(_mutex);
+#if !_WIN32
+        for(auto& directory : _directories)
+        {
+            int fileDescriptor = open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fileDescriptor >= 0)
+            {
+                fsync(fileDescriptor);
+                close(fileDescriptor);
+            }
+        }
+#endif
+        _directories.clear();
+    }
+
+private:
+    Durability _durability;
+    std::mutex _mutex;
+    std::set<std::filesystem::path> _directories;
+};
+
+inline bool write(std::filesystem::path path, std::string_view data, Durability durability = Durability::Atomic)
+{
+    WriteBatch batch(durability);
+    return batch.write(path, data);
+}
+
+// Copies a file like cp would, overwriting the target and giving it a new
+// modification time. On Linux the data is shared with a reflink when the file
+// system supports it, and otherwise copied in the kernel.
+inline void copy(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& errorCode)
+{
+    errorCode.clear();
+#if __linux__
+    int input = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if(input < 0)
     {
-        throw std::runtime_error("Could not open file " + path.string() + " for mapping.");
+        errorCode = std::error_code(errno, std::generic_category());
+        return;
     }
-    Destructor fileDestructor([fileDescriptor](){ close(fileDescriptor); });
 
     struct stat statData;
-    int err = fstat(fileDescriptor, &statData);
-    if(err < 0)
+    if(fstat(input, &statData) != 0)
     {
-        throw std::runtime_error("Could not stat file " + path.string() + " for mapping.");
+        errorCode = std::error_code(errno, std::generic_category());
+        close(input);
+        return;
     }
 
+    // Truncating the target would empty the source if they're the same file,
+    // which cp refuses to copy as well
+    struct stat targetStatData;
+    if(stat(to.c_str(), &targetStatData) == 0 && targetStatData.st_dev == statData.st_dev && targetStatData.st_ino == statData.st_ino)
+    {
+        errorCode = std::make_error_code(std::errc::invalid_argument);
+        close(input);
+        return;
+    }
 
-    struct Unmapper {
-        void operator()(T*) {  };
-    };
-    void* ptr = mmap(0, statData.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    int output = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, statData.st_mode & 0777);
+    if(output < 0)
+    {
+        errorCode = std::error_code(errno, std::generic_category());
+        close(input);
+        return;
+    }
 
+    bool cloned = false;
+#ifdef FICLONE
+    if(ioctl(output, FICLONE, input) == 0)
+    {
+        // A clone doesn't necessarily count as a modification
+        futimens(output, nullptr);
+        cloned = true;
+    }
+#endif
+
+    bool kernelCopy = !cloned;
+    while(!cloned)
+    {
+        ssize_t copied;
+        if(kernelCopy)
+        {
+            copied = copy_file_range(input, nullptr, output, nullptr, 1 << 30, 0);
+            if(copied < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                kernelCopy = false;
+                continue;
+            }
+        }
+        else
+        {
+            std::array<char, 64 * 1024> buffer;
+            copied = ::read(input, buffer.data(), buffer.size());
+            for(ssize_t written = 0; copied > 0 && written < copied; )
+            {
+                auto result = ::write(output, buffer.data() + written, copied - written);
+                if(result < 0)
+                {
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+                    copied = -1;
+                    break;
+                }
+                written += result;
+            }
+        }
+
+        if(copied < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            errorCode = std::error_code(errno, std::generic_category());
+            break;
+        }
+
+        if(copied == 0)
+        {
+            break;
+        }
+    }
+
+    close(input);
+    if(close(output) != 0 && !errorCode)
+    {
+        errorCode = std::error_code(errno, std::generic_category());
+    }
+#else
+    std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, errorCode);
+    if(!errorCode)
+    {
+        std::filesystem::last_write_time(to, std::filesystem::file_time_type::clock::now(), errorCode);
+    }
+#endif
 }
 
+// Creates the file if it doesn't exist and sets its modification time to now.
+inline void touch(const std::filesystem::path& path, std::error_code& errorCode)
+{
+    errorCode.clear();
+#if _WIN32
+    if(!std::filesystem::exists(path, errorCode))
+    {
+        std::ofstream stream(path, std::ios_base::binary | std::ios_base::app);
+        if(!stream)
+        {
+            errorCode = std::make_error_code(std::errc::io_error);
+            return;
+        }
+    }
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), errorCode);
+#else
+    // Existing files aren't opened, since they may be running executables
+    if(utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == 0)
+    {
+        return;
+    }
+    if(errno != ENOENT)
+    {
+        errorCode = std::error_code(errno, std::generic_category());
+        return;
+    }
+
+    int fileDescriptor = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if(fileDescriptor < 0)
+    {
+        errorCode = std::error_code(errno, std::generic_category());
+        return;
+    }
+    close(fileDescriptor);
 #endif
+}
+
+// Creates directories, remembering which ones are known to exist so each one
+// is only checked once. Safe to use from multiple threads.
+struct DirectoryCache
+{
+public:
+    void create(const std::filesystem::path& path, std::error_code& errorCode)
+    {
+        errorCode.clear();
+        if(path.empty())
+        {
+            return;
+        }
+
+        auto pathStr = path.lexically_normal().string();
+        {
+            std::scoped_lock lock(_mutex);
+            if(_known.find(pathStr) != _known.end())
+            {
+                return;
+            }
+        }
+
+        std::filesystem::create_directories(path, errorCode);
+        if(errorCode)
+        {
+            return;
+        }
+
+        std::scoped_lock lock(_mutex);
+        for(auto dir = std::filesystem::path(pathStr); !dir.empty() && dir != dir.parent_path(); dir = dir.parent_path())
+        {
+            if(!_known.insert(dir.string()).second)
+            {
+                break;
+            }
+        }
+    }
+
+private:
+    std::mutex _mutex;
+    std::unordered_set<std::string> _known;
+};
+
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <filesystem>
 
 #include "core/property.h"
@@ -28,6 +29,8 @@ inline OptionCollection bundleResources(const std::filesystem::path& path, const
 }
 #endif
 
+// Files are sorted, so the result doesn't depend on the file system.
+// Safe to call concurrently, e.g. from Environment::parallelFor tasks.
 template<typename T>
 std::vector<std::filesystem::path> files(const std::filesystem::path& path, const T& filter, bool recurse = true)
 {
@@ -66,6 +69,7 @@ std::vector<std::filesystem::path> files(const std::filesystem::path& path, cons
         scan(std::filesystem::directory_iterator(path));
     }
 
+    std::sort(result.begin(), result.end());
     return result;
 }
 
@@ -74,4 +78,26 @@ inline std::vector<std::filesystem::path> files(const std::filesystem::path& pat
     return files(path, [](const std::filesystem::path& path) { return true; }, recurse);
 }
 
+// Directories directly in path, sorted.
+inline std::vector<std::filesystem::path> directories(const std::filesystem::path& path)
+{
+    std::vector<std::filesystem::path> result;
+
+    if(!std::filesystem::exists(path))
+    {
+        return result;
+    }
+
+    for(auto entry : std::filesystem::directory_iterator(path))
+    {
+        if(entry.is_directory())
+        {
+            result.push_back(entry.path());
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
 }
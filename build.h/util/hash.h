@@ -1,171 +1,428 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string>
 #include <string_view>
 
+#include "util/file.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BUILD_H_HASH_SHANI 1
+#define BUILD_H_HASH_SHANI_TARGET __attribute__((target("sha,sse4.1")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define BUILD_H_HASH_SHANI 1
+#define BUILD_H_HASH_SHANI_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
 namespace hash
 {
 
-struct Md5Digester
+// Fast, non-cryptographic 128 bit hash (MurmurHash3 x64 128) for content
+// fingerprints and change detection.
+struct Murmur3Digester
 {
 public:
+    using Digest = std::array<uint8_t, 16>;
+
+    Murmur3Digester(uint32_t seed = 0)
+        : _h1(seed)
+        , _h2(seed)
+    { }
+
     void digest(std::string_view input)
     {
-        while(!input.empty())
+        _length += input.size();
+
+        if(_count > 0)
         {
-            size_t chunk = std::min(input.size(), 64-_count);
+            size_t chunk = std::min(input.size(), 16-_count);
             memcpy(_data + _count, input.data(), chunk);
-            _count = (_count + chunk) & 63;
+            _count += chunk;
             input = input.substr(chunk);
-            if(_count == 0)
+            if(_count < 16)
             {
-                processBlock();
+                return;
             }
+            processBlock(_data);
+            _count = 0;
+        }
+
+        while(input.size() >= 16)
+        {
+            processBlock(reinterpret_cast<const uint8_t*>(input.data()));
+            input = input.substr(16);
         }
+
+        memcpy(_data, input.data(), input.size());
+        _count = input.size();
     }
 
-    std::array<char, 16> finalize()
+    Digest finalize()
     {
-        size_t pad = _count < 55 ? 56 - _count;
-        
-        static const char padding[70] = { 0x80 };
-        digest(std::string_view(padding, ));
-        std::array<char, 16> result;        
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+        for(size_t i = _count; i > 8; --i)
+        {
+            k2 = (k2 << 8) | _data[i-1];
+        }
+        for(size_t i = std::min(_count, (size_t)8); i > 0; --i)
+        {
+            k1 = (k1 << 8) | _data[i-1];
+        }
+
+        if(_count > 8)
+        {
+            k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; _h2 ^= k2;
+        }
+        if(_count > 0)
+        {
+            k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; _h1 ^= k1;
+        }
+
+        _h1 ^= _length;
+        _h2 ^= _length;
 
+        _h1 += _h2;
+        _h2 += _h1;
+
+        _h1 = fmix(_h1);
+        _h2 = fmix(_h2);
+
+        _h1 += _h2;
+        _h2 += _h1;
+
+        Digest result;
+        for(size_t i = 0; i < 8; ++i)
+        {
+            result[i] = (uint8_t)(_h1 >> (i*8));
+            result[i+8] = (uint8_t)(_h2 >> (i*8));
+        }
         return result;
     }
 
 private:
-    void processBlock()
+    static constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+    static constexpr uint64_t c2 = 0x4cf5ad432745937full;
+
+    static uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t fmix(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+    static uint64_t load64(const uint8_t* data)
     {
-        auto step1 = [](uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t in, uint32_t shift)
+        uint64_t result = 0;
+        for(int i = 7; i >= 0; --i)
         {
-            a += b ^ (b & (c ^ d));
-            a += in;
-            a = (a<<shift) | (a>>(32-shift));
-            return a + b;
-        };
+            result = (result << 8) | data[i];
+        }
+        return result;
+    }
+
+    void processBlock(const uint8_t* block)
+    {
+        uint64_t k1 = load64(block);
+        uint64_t k2 = load64(block + 8);
+
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; _h1 ^= k1;
+        _h1 = rotl(_h1, 27); _h1 += _h2; _h1 = _h1*5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; _h2 ^= k2;
+        _h2 = rotl(_h2, 31); _h2 += _h1; _h2 = _h2*5 + 0x38495ab5;
+    }
+
+    uint64_t _h1;
+    uint64_t _h2;
+    uint8_t _data[16];
+    size_t _count = 0;
+    uint64_t _length = 0;
+};
+
+// SHA-256, for cache keys where collisions must be out of the question.
+// Uses the SHA extensions on x86 CPUs that have them.
+struct Sha256Digester
+{
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    void digest(std::string_view input)
+    {
+        _length += input.size();
+
+        if(_count > 0)
+        {
+            size_t chunk = std::min(input.size(), 64-_count);
+            memcpy(_data + _count, input.data(), chunk);
+            _count += chunk;
+            input = input.substr(chunk);
+            if(_count < 64)
+            {
+                return;
+            }
+            processBlocks(_data, 1);
+            _count = 0;
+        }
 
-        auto step2 = [](uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t in, uint32_t shift)
+        size_t blocks = input.size() / 64;
+        if(blocks > 0)
         {
-            a += d ^ (d & (b ^ c));
-            a += in;
-            a = (a<<shift) | (a>>(32-shift));
-            return a + b;
-        };
+            processBlocks(reinterpret_cast<const uint8_t*>(input.data()), blocks);
+            input = input.substr(blocks * 64);
+        }
+
+        memcpy(_data, input.data(), input.size());
+        _count = input.size();
+    }
 
-        auto step3 = [](uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t in, uint32_t shift)
+    Digest finalize()
+    {
+        uint64_t bitLength = _length * 8;
+
+        static const uint8_t padding[64] = { 0x80 };
+        size_t padSize = _count < 56 ? 56 - _count : 120 - _count;
+        digest(std::string_view(reinterpret_cast<const char*>(padding), padSize));
+
+        uint8_t lengthData[8];
+        for(size_t i = 0; i < 8; ++i)
         {
-            a += b ^ c ^ d;
-            a += in;
-            a = (a<<shift) | (a>>(32-shift));
-            return a + b;
-        };
+            lengthData[i] = (uint8_t)(bitLength >> (56 - i*8));
+        }
+        digest(std::string_view(reinterpret_cast<const char*>(lengthData), 8));
 
-        auto step4 = [](uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t in, uint32_t shift)
+        Digest result;
+        for(size_t i = 0; i < 8; ++i)
         {
-            a += c ^ (b | ~d);
-            a += in;
-            a = (a<<shift) | (a>>(32-shift));
-            return a + b;
-        };
-
-        uint32_t input[16];
-        memcpy(input, _data, 64);
-
-        uint32_t x = _state[0];
-        uint32_t y = _state[1];
-        uint32_t z = _state[2];
-        uint32_t w = _state[3];
-
-        x = step1(x, y, z, w, input[ 0] + 0xd76aa478,  7);
-        y = step1(y, z, w, x, input[ 1] + 0xe8c7b756, 12);
-        z = step1(z, w, x, y, input[ 2] + 0x242070db, 17);
-        w = step1(w, x, y, z, input[ 3] + 0xc1bdceee, 22);
-        x = step1(x, y, z, w, input[ 4] + 0xf57c0faf,  7);
-        y = step1(y, z, w, x, input[ 5] + 0x4787c62a, 12);
-        z = step1(z, w, x, y, input[ 6] + 0xa8304613, 17);
-        w = step1(w, x, y, z, input[ 7] + 0xfd469501, 22);
-        x = step1(x, y, z, w, input[ 8] + 0x698098d8,  7);
-        y = step1(y, z, w, x, input[ 9] + 0x8b44f7af, 12);
-        z = step1(z, w, x, y, input[10] + 0xffff5bb1, 17);
-        w = step1(w, x, y, z, input[11] + 0x895cd7be, 22);
-        x = step1(x, y, z, w, input[12] + 0x6b901122,  7);
-        y = step1(y, z, w, x, input[13] + 0xfd987193, 12);
-        z = step1(y, w, x, y, input[14] + 0xa679438e, 17);
-        w = step1(w, x, y, z, input[15] + 0x49b40821, 22);
-
-        x = step2(x, y, z, w, input[ 1] + 0xf61e2562,  5);
-        y = step2(y, z, w, x, input[ 6] + 0xc040b340,  9);
-        z = step2(z, w, x, y, input[11] + 0x265e5a51, 14);
-        w = step2(w, x, y, z, input[ 0] + 0xe9b6c7aa, 20);
-        x = step2(x, y, z, w, input[ 5] + 0xd62f105d,  5);
-        y = step2(y, z, w, x, input[10] + 0x02441453,  9);
-        z = step2(z, w, x, y, input[15] + 0xd8a1e681, 14);
-        w = step2(w, x, y, z, input[ 4] + 0xe7d3fbc8, 20);
-        x = step2(x, y, z, w, input[ 9] + 0x21e1cde6,  5);
-        y = step2(y, z, w, x, input[14] + 0xc33707d6,  9);
-        z = step2(z, w, x, y, input[ 3] + 0xf4d50d87, 14);
-        w = step2(w, x, y, z, input[ 8] + 0x455a14ed, 20);
-        x = step2(x, y, z, w, input[13] + 0xa9e3e905,  5);
-        y = step2(y, z, w, x, input[ 2] + 0xfcefa3f8,  9);
-        z = step2(y, w, x, y, input[ 7] + 0x676f02d9, 14);
-        w = step2(w, x, y, z, input[12] + 0x8d2a4c8a, 20);
-
-        x = step3(x, y, z, w, input[ 5] + 0xfffa3942,  4);
-        y = step3(y, z, w, x, input[ 8] + 0x8771f681, 11);
-        z = step3(z, w, x, y, input[11] + 0x6d9d6122, 16);
-        w = step3(w, x, y, z, input[14] + 0xfde5380c, 23);
-        x = step3(x, y, z, w, input[ 1] + 0xa4beea44,  4);
-        y = step3(y, z, w, x, input[ 4] + 0x4bdecfa9, 11);
-        z = step3(z, w, x, y, input[ 7] + 0xf6bb4b60, 16);
-        w = step3(w, x, y, z, input[10] + 0xbebfbc70, 23);
-        x = step3(x, y, z, w, input[13] + 0x289b7ec6,  4);
-        y = step3(y, z, w, x, input[ 0] + 0xeaa127fa, 11);
-        z = step3(z, w, x, y, input[ 3] + 0xd4ef3085, 16);
-        w = step3(w, x, y, z, input[ 6] + 0x04881d05, 23);
-        x = step3(x, y, z, w, input[ 9] + 0xd9d4d039,  4);
-        y = step3(y, z, w, x, input[12] + 0xe6db99e5, 11);
-        z = step3(y, w, x, y, input[15] + 0x1fa27cf8, 16);
-        w = step3(w, x, y, z, input[ 2] + 0xc4ac5665, 23);
-
-        x = step4(x, y, z, w, input[ 0] + 0xf4292244,  6);
-        y = step4(y, z, w, x, input[ 7] + 0x432aff97, 10);
-        z = step4(z, w, x, y, input[14] + 0xab9423a7, 15);
-        w = step4(w, x, y, z, input[ 5] + 0xfc93a039, 21);
-        x = step4(x, y, z, w, input[12] + 0x655b59c3,  6);
-        y = step4(y, z, w, x, input[ 3] + 0x8f0ccc92, 10);
-        z = step4(z, w, x, y, input[10] + 0xffeff47d, 15);
-        w = step4(w, x, y, z, input[ 1] + 0x85845dd1, 21);
-        x = step4(x, y, z, w, input[ 8] + 0x6fa87e4f,  6);
-        y = step4(y, z, w, x, input[15] + 0xfe2ce6e0, 10);
-        z = step4(z, w, x, y, input[ 6] + 0xa3014314, 15);
-        w = step4(w, x, y, z, input[13] + 0x4e0811a1, 21);
-        x = step4(x, y, z, w, input[ 4] + 0xf7537e82,  6);
-        y = step4(y, z, w, x, input[11] + 0xbd3af235, 10);
-        z = step4(y, w, x, y, input[ 2] + 0x2ad7d2bb, 15);
-        w = step4(w, x, y, z, input[ 9] + 0xeb86d391, 21);
-
-        _state[0] = x;
-        _state[1] = y;
-        _state[2] = z;
-        _state[3] = w;
+            result[i*4+0] = (uint8_t)(_state[i] >> 24);
+            result[i*4+1] = (uint8_t)(_state[i] >> 16);
+            result[i*4+2] = (uint8_t)(_state[i] >> 8);
+            result[i*4+3] = (uint8_t)(_state[i]);
+        }
+        return result;
     }
 
-    uint32_t _state[4] = {
-        0x67425301,
-        0xEDFCBA45,
-        0x98CBADFE,
-        0x13DCE476,
+private:
+    alignas(16) static constexpr uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
     };
 
-    char _data[64];
+    static uint32_t rotr(uint32_t x, int r)
+    {
+        return (x >> r) | (x << (32 - r));
+    }
+
+    void processBlocks(const uint8_t* data, size_t blocks)
+    {
+#if BUILD_H_HASH_SHANI
+        if(hasShaExtensions())
+        {
+            processBlocksShaNi(_state, data, blocks);
+            return;
+        }
+#endif
+        processBlocksScalar(_state, data, blocks);
+    }
+
+    static void processBlocksScalar(uint32_t* state, const uint8_t* data, size_t blocks)
+    {
+        for(; blocks > 0; --blocks, data += 64)
+        {
+            uint32_t w[64];
+            for(size_t i = 0; i < 16; ++i)
+            {
+                w[i] = ((uint32_t)data[i*4] << 24) | ((uint32_t)data[i*4+1] << 16) | ((uint32_t)data[i*4+2] << 8) | data[i*4+3];
+            }
+            for(size_t i = 16; i < 64; ++i)
+            {
+                uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+                uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+                w[i] = w[i-16] + s0 + w[i-7] + s1;
+            }
+
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+            for(size_t i = 0; i < 64; ++i)
+            {
+                uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+                uint32_t ch = (e & f) ^ (~e & g);
+                uint32_t t1 = h + s1 + ch + k[i] + w[i];
+                uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+                uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+                uint32_t t2 = s0 + maj;
+
+                h = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+            }
+
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        }
+    }
+
+#if BUILD_H_HASH_SHANI
+    static bool hasShaExtensions()
+    {
+        static const bool supported = [](){
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if(info[0] < 7) return false;
+            __cpuid(info, 1);
+            bool ssse3 = info[2] & (1 << 9);
+            bool sse41 = info[2] & (1 << 19);
+            __cpuidex(info, 7, 0);
+            return ssse3 && sse41 && (info[1] & (1 << 29));
+#else
+            unsigned int a, b, c, d;
+            if(!__get_cpuid(1, &a, &b, &c, &d)) return false;
+            bool ssse3 = c & (1 << 9);
+            bool sse41 = c & (1 << 19);
+            if(!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return false;
+            return ssse3 && sse41 && (b & (1 << 29));
+#endif
+        }();
+        return supported;
+    }
+
+    BUILD_H_HASH_SHANI_TARGET
+    static void processBlocksShaNi(uint32_t* state, const uint8_t* data, size_t blocks)
+    {
+        const __m128i byteSwapMask = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+        // The SHA instructions want the state as ABEF/CDGH
+        __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+        __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+        tmp = _mm_shuffle_epi32(tmp, 0xB1);
+        state1 = _mm_shuffle_epi32(state1, 0x1B);
+        __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+        state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+        for(; blocks > 0; --blocks, data += 64)
+        {
+            __m128i savedState0 = state0;
+            __m128i savedState1 = state1;
+
+            __m128i messages[4];
+            for(int i = 0; i < 16; ++i)
+            {
+                if(i < 4)
+                {
+                    messages[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i*16)), byteSwapMask);
+                }
+
+                __m128i& current = messages[i%4];
+                __m128i message = _mm_add_epi32(current, _mm_load_si128(reinterpret_cast<const __m128i*>(k + i*4)));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+
+                if(i >= 3 && i < 15)
+                {
+                    __m128i& next = messages[(i+1)%4];
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(current, messages[(i+3)%4], 4));
+                    next = _mm_sha256msg2_epu32(next, current);
+                }
+
+                message = _mm_shuffle_epi32(message, 0x0E);
+                state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+
+                if(i >= 1 && i < 13)
+                {
+                    __m128i& previous = messages[(i+3)%4];
+                    previous = _mm_sha256msg1_epu32(previous, current);
+                }
+            }
+
+            state0 = _mm_add_epi32(state0, savedState0);
+            state1 = _mm_add_epi32(state1, savedState1);
+        }
+
+        tmp = _mm_shuffle_epi32(state0, 0x1B);
+        state1 = _mm_shuffle_epi32(state1, 0xB1);
+        state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+        state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+    }
+#endif
+
+    uint32_t _state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    uint8_t _data[64];
     size_t _count = 0;
+    uint64_t _length = 0;
 };
 
-std::array<char, 16> md5(std::string_view input)
+inline Murmur3Digester::Digest fingerprint(std::string_view input)
 {
-    return {};
+    Murmur3Digester digester;
+    digester.digest(input);
+    return digester.finalize();
 }
 
-}
\ No newline at end of file
+inline Sha256Digester::Digest sha256(std::string_view input)
+{
+    Sha256Digester digester;
+    digester.digest(input);
+    return digester.finalize();
+}
+
+// Hashes the contents of a file, reading it through a memory mapping.
+// Returns nothing if the file couldn't be read.
+template<typename Digester>
+std::optional<typename Digester::Digest> digestFile(const std::filesystem::path& path)
+{
+    file::MappedFile mapped(path);
+    if(!mapped)
+    {
+        return {};
+    }
+
+    Digester digester;
+    digester.digest(mapped.view());
+    return digester.finalize();
+}
+
+template<size_t Size>
+std::string toHex(const std::array<uint8_t, Size>& digest)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+    result.reserve(Size * 2);
+    for(auto byte : digest)
+    {
+        result += digits[byte >> 4];
+        result += digits[byte & 15];
+    }
+    return result;
+}
+
+}
@@ -1,10 +1,34 @@
 #pragma once
 
+#include <cstdio>
+#include <cstdlib>
 #include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "core/emitter.h"
+#include "emitters/action.h"
+#include "emitters/compilecommands.h"
+#include "emitters/direct.h"
+#include "emitters/ninja.h"
+#include "emitters/query.h"
+#include "modules/command.h"
+#include "modules/toolchain.h"
 #include "util/cli.h"
+#include "util/process.h"
+#include "util/profile.h"
 
+// Options available to every action, handled by runGenerator itself
+inline std::vector<cli::Argument*>& generalArguments()
+{
+    static std::vector<cli::Argument*> arguments;
+    return arguments;
+}
+
+inline cli::BoolArgument timePhases{generalArguments(), "time-phases", "Print the time spent in each phase of the generator, e.g. configuring, resolving settings and running commands."};
+inline cli::PathArgument traceFile{generalArguments(), "trace", "Write the phases of the generator and its threads to a Chrome trace file."};
 
 void printUsage(cli::Context& cliContext)
 {
@@ -19,6 +43,11 @@ void printUsage(cli::Context& cliContext)
             std::cout << "  " << str::padRightToSize(argument->example, 30) + "  " + argument->description + "\n";
         }
     }
+    std::cout << "\nGeneral options:\n";
+    for(auto argument : generalArguments())
+    {
+        std::cout << "  " << str::padRightToSize(argument->example, 30) + "  " + argument->description + "\n";
+    }
     std::cout << "\n";
 
     bool first = true;
@@ -38,15 +67,15 @@ void printUsage(cli::Context& cliContext)
     }
 }
 
-#ifndef CUSTOM_BUILD_H_MAIN
-
-void configure(Environment& env);
-int main(int argc, const char** argv)
+// Parses the command line, configures the build with the given function and
+// runs the chosen action. Returns the process exit code.
+inline int runGenerator(const std::filesystem::path& startPath, std::string invocation, std::vector<std::string> arguments, void (*configure)(Environment&), const std::filesystem::path& generatorModule = {}, bool* reloadRequested = nullptr)
 {
-    cli::Context cliContext(
-        std::filesystem::current_path(),
-        argc > 0 ? argv[0] : "", 
-        std::vector<std::string>(argv+std::min(1, argc), argv+argc));
+    cli::Context cliContext(startPath, std::move(invocation), std::move(arguments));
+    // build.h's own sources are linked from a static library, so the built-in
+    // emitters must be referenced for their objects to be linked at all.
+    [[maybe_unused]] static Emitter* volatile linkedEmitters[] = { &DirectBuilder::instance, &NinjaEmitter::instance, &CompileCommands::instance, &Query::instance, &ActionRunner::instance };
+
     try
     {
         auto& availableEmitters = Emitters::list();        
@@ -71,6 +100,11 @@ int main(int argc, const char** argv)
             throw cli::argument_error("Unknown action \"" + std::string(cliContext.action) + "\"");
         }
 
+        for(auto argument : generalArguments())
+        {
+            cliContext.extractArgument(argument);
+        }
+
         for(auto argument : cli::Argument::globalList())
         {
             cliContext.extractArgument(argument);
@@ -81,16 +115,47 @@ int main(int argc, const char** argv)
             cliContext.extractArgument(argument);
         }
 
-        Environment env(cliContext);
+        auto environment = std::make_unique<Environment>(cliContext);
+        auto& env = *environment;
+        env.generatorModule = generatorModule;
         std::filesystem::current_path(env.configurationFile.parent_path());
-        configure(env);
+        profile::Profiler::instance().start(timePhases || traceFile);
+        {
+            profile::Scope scope("Configure");
+            configure(env);
+        }
 
         for(auto& argument : cliContext.unusedArguments)
         {
             throw cli::argument_error("WARNING: Unknown argument \"" + argument + "\" was ignored.");
         }
 
-        chosenEmitter->emit(env);
+        {
+            profile::Scope scope("Emit", chosenEmitter->name);
+            chosenEmitter->emit(env);
+        }
+
+        if(timePhases)
+        {
+            std::cout << "\n";
+            profile::Profiler::instance().printSummary(std::cout);
+        }
+        if(traceFile)
+        {
+            profile::Profiler::instance().writeChromeTrace(*traceFile);
+        }
+
+        if(reloadRequested)
+        {
+            *reloadRequested = env.reloadRequested;
+        }
+        else
+        {
+            // The process exits right away, so the project model is left for
+            // the OS to reclaim instead of being freed one object at a time.
+            environment.release();
+        }
+        return 0;
     }
     catch(const cli::argument_error& e)
     {
@@ -104,4 +169,108 @@ int main(int argc, const char** argv)
         return -1;
     }
 }
-#endif
\ No newline at end of file
+
+#if defined(BUILD_H_MODULE)
+
+// Built as a module for the hot reload host, which provides build.h itself and
+// calls into the configuration through this.
+void configure(Environment& env);
+extern "C" __attribute__((visibility("default"))) void buildhConfigure(Environment& env)
+{
+    configure(env);
+}
+
+#elif defined(BUILD_H_HOST)
+
+#if defined(_WIN32)
+#error "The hot reload host is not supported on Windows."
+#endif
+
+// The hot reload host loads the build configuration as a shared library with
+// the same name as the host, e.g. "build.so" next to "build". When the
+// configuration has changed the build action rebuilds only that library, and
+// the host loads it again instead of starting a new process, keeping the
+// StringId table and file time caches warm.
+int main(int argc, const char** argv)
+{
+    auto startPath = std::filesystem::current_path();
+    std::string invocation = argc > 0 ? argv[0] : "";
+    std::vector<std::string> arguments(argv+std::min(1, argc), argv+argc);
+    auto modulePath = std::filesystem::absolute(process::findCurrentModulePath()).replace_extension(".so");
+
+    for(size_t generation = 0; ; ++generation)
+    {
+        // Anything the module registers is dropped again when it's unloaded
+        size_t argumentCount = cli::Argument::globalList().size();
+        size_t emitterCount = Emitters::list().size();
+        size_t toolchainCount = Toolchains::list().size();
+
+        // A module with the same path as an already loaded one is never loaded
+        // again, so each generation is loaded through a link of its own.
+        auto loadPath = modulePath;
+        loadPath += "." + std::to_string(getpid()) + "." + std::to_string(generation);
+        std::error_code ec;
+        std::filesystem::create_hard_link(modulePath, loadPath, ec);
+        if(ec)
+        {
+            std::filesystem::copy_file(modulePath, loadPath, std::filesystem::copy_options::overwrite_existing, ec);
+        }
+        void* module = ec ? nullptr : dlopen(loadPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+        std::filesystem::remove(loadPath, ec);
+        if(!module)
+        {
+            std::cerr << "ERROR: Failed to load build configuration '" << modulePath.string() << "'";
+            if(auto error = dlerror())
+            {
+                std::cerr << ": " << error;
+            }
+            std::cerr << "\nBootstrap it with --hot-reload to build it.\n";
+            return -1;
+        }
+
+        auto configure = reinterpret_cast<void (*)(Environment&)>(dlsym(module, "buildhConfigure"));
+        if(!configure)
+        {
+            std::cerr << "ERROR: '" << modulePath.string() << "' is not a build configuration module.\n";
+            dlclose(module);
+            return -1;
+        }
+
+        std::filesystem::current_path(startPath);
+        bool reloadRequested = false;
+        int result = runGenerator(startPath, invocation, arguments, configure, modulePath, &reloadRequested);
+
+        CallableActions::clear();
+        dlclose(module);
+        cli::Argument::globalList().resize(argumentCount);
+        Emitters::truncate(emitterCount);
+        Toolchains::truncate(toolchainCount);
+
+        if(!reloadRequested)
+        {
+            return result;
+        }
+    }
+}
+
+#elif !defined(CUSTOM_BUILD_H_MAIN)
+
+void configure(Environment& env);
+int main(int argc, const char** argv)
+{
+    int result = runGenerator(
+        std::filesystem::current_path(),
+        argc > 0 ? argv[0] : "", 
+        std::vector<std::string>(argv+std::min(1, argc), argv+argc),
+        &configure);
+
+    // Everything that must reach the disk has been written explicitly by now.
+    // Exiting without running static destructors skips freeing the interned
+    // strings and caches, which only takes time.
+    std::cout << std::flush;
+    std::cerr << std::flush;
+    std::fflush(nullptr);
+    std::_Exit(result);
+}
+
+#endif
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Estimates of memory used by build.h's data structures, for finding out
+// what a large build configuration spends its memory on. Sizes are computed
+// from container sizes and capacities rather than measured, so allocator
+// overhead isn't included, but they are close enough to compare structures.
+namespace memory
+{
+
+// Heap memory owned by a value, not counting the value itself. Specialize
+// for types owning memory; everything else is assumed to own none.
+template<typename T>
+struct HeapSize
+{
+    static size_t get(const T&)
+    {
+        return 0;
+    }
+};
+
+template<typename T>
+size_t heapSize(const T& value)
+{
+    return HeapSize<T>::get(value);
+}
+
+// Allocations are rounded up to this by common allocators
+inline size_t allocationSize(size_t size)
+{
+    constexpr size_t granularity = alignof(std::max_align_t);
+    return size == 0 ? 0 : (size + granularity - 1) / granularity * granularity;
+}
+
+// Node based containers allocate every element separately, with a couple of
+// pointers of bookkeeping.
+inline size_t nodeSize(size_t valueSize, size_t pointers)
+{
+    return allocationSize(valueSize + pointers * sizeof(void*));
+}
+
+template<>
+struct HeapSize<std::string>
+{
+    static size_t get(const std::string& str)
+    {
+        static const size_t inlineCapacity = std::string().capacity();
+        return str.capacity() > inlineCapacity ? allocationSize(str.capacity() + 1) : 0;
+    }
+};
+
+template<>
+struct HeapSize<std::filesystem::path>
+{
+    static size_t get(const std::filesystem::path& path)
+    {
+        size_t size = heapSize(path.native());
+#if defined(__GLIBCXX__)
+        // libstdc++ also keeps every component of a path with more than one
+        // as a separate path.
+        auto begin = path.begin();
+        if(begin != path.end() && std::next(begin) != path.end())
+        {
+            size_t count = 0;
+            for(auto& component : path)
+            {
+                size += heapSize(component.native());
+                ++count;
+            }
+            size += allocationSize(2 * sizeof(int) + count * (sizeof(std::filesystem::path) + sizeof(size_t)));
+        }
+#endif
+        return size;
+    }
+};
+
+template<typename T, typename A>
+struct HeapSize<std::vector<T, A>>
+{
+    static size_t get(const std::vector<T, A>& vector)
+    {
+        size_t size = allocationSize(vector.capacity() * sizeof(T));
+        for(auto& element : vector)
+        {
+            size += heapSize(element);
+        }
+        return size;
+    }
+};
+
+template<typename T>
+struct HeapSize<std::optional<T>>
+{
+    static size_t get(const std::optional<T>& optional)
+    {
+        return optional ? heapSize(*optional) : 0;
+    }
+};
+
+template<typename A, typename B>
+struct HeapSize<std::pair<A, B>>
+{
+    static size_t get(const std::pair<A, B>& pair)
+    {
+        return heapSize(pair.first) + heapSize(pair.second);
+    }
+};
+
+template<typename K, typename V, typename C, typename A>
+struct HeapSize<std::map<K, V, C, A>>
+{
+    static size_t get(const std::map<K, V, C, A>& map)
+    {
+        size_t size = 0;
+        for(auto& entry : map)
+        {
+            size += nodeSize(sizeof(entry), 3) + heapSize(entry.first) + heapSize(entry.second);
+        }
+        return size;
+    }
+};
+
+// Buckets plus a node per element, with the hash code cached in each node.
+inline size_t hashTableSize(size_t count, size_t bucketCount, size_t valueSize)
+{
+    return allocationSize(bucketCount * sizeof(void*)) + count * nodeSize(valueSize + sizeof(size_t), 1);
+}
+
+template<typename K, typename V, typename H, typename E, typename A>
+struct HeapSize<std::unordered_map<K, V, H, E, A>>
+{
+    static size_t get(const std::unordered_map<K, V, H, E, A>& map)
+    {
+        size_t size = hashTableSize(map.size(), map.bucket_count(), sizeof(typename std::unordered_map<K, V, H, E, A>::value_type));
+        for(auto& entry : map)
+        {
+            size += heapSize(entry.first) + heapSize(entry.second);
+        }
+        return size;
+    }
+};
+
+template<typename T, typename H, typename E, typename A>
+struct HeapSize<std::unordered_set<T, H, E, A>>
+{
+    static size_t get(const std::unordered_set<T, H, E, A>& set)
+    {
+        size_t size = hashTableSize(set.size(), set.bucket_count(), sizeof(T));
+        for(auto& entry : set)
+        {
+            size += heapSize(entry);
+        }
+        return size;
+    }
+};
+
+// Object counts and bytes per category, printed as a table.
+class Report
+{
+public:
+    void add(std::string_view category, size_t count, size_t bytes)
+    {
+        auto it = std::find_if(_entries.begin(), _entries.end(), [&](auto& entry) { return entry.category == category; });
+        if(it == _entries.end())
+        {
+            _entries.push_back({ std::string(category) });
+            it = _entries.end() - 1;
+        }
+        it->count += count;
+        it->bytes += bytes;
+    }
+
+    void print(std::ostream& stream) const
+    {
+        size_t categoryWidth = 0;
+        for(auto& entry : _entries)
+        {
+            categoryWidth = std::max(categoryWidth, entry.category.size());
+        }
+
+        for(auto& entry : _entries)
+        {
+            stream << "  " << entry.category << std::string(categoryWidth - entry.category.size(), ' ')
+                   << std::setw(12) << entry.count << " objects"
+                   << std::setw(12) << formatBytes(entry.bytes) << "\n";
+        }
+    }
+
+    static std::string formatBytes(size_t bytes)
+    {
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(1);
+        if(bytes >= 1024 * 1024 * 1024)
+        {
+            stream << bytes / (1024.0 * 1024.0 * 1024.0) << "GB";
+        }
+        else if(bytes >= 1024 * 1024)
+        {
+            stream << bytes / (1024.0 * 1024.0) << "MB";
+        }
+        else if(bytes >= 1024)
+        {
+            stream << bytes / 1024.0 << "kB";
+        }
+        else
+        {
+            stream << bytes << "B";
+        }
+        return stream.str();
+    }
+
+private:
+    struct Entry
+    {
+        std::string category;
+        size_t count = 0;
+        size_t bytes = 0;
+    };
+
+    std::vector<Entry> _entries;
+};
+
+}
@@ -1,10 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <stdio.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 #if _WIN32
 #define NOMINMAX
@@ -12,7 +26,19 @@
 #include <io.h>
 #else
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <unistd.h>
+
+extern char** environ;
+#endif
+
+#if __linux__
+#include <sched.h>
 #endif
 
 #include "core/os.h"
@@ -42,10 +68,27 @@ inline static std::filesystem::path findCurrentModulePath()
 }
 #endif
 
+// Resources used by a finished process, including any children it waited for.
+// Only the wall time is measured on Windows.
+struct ResourceUsage
+{
+    double wallTime = 0.0;
+    double userTime = 0.0;
+    double systemTime = 0.0;
+    uint64_t peakMemory = 0;
+    uint64_t blockInputs = 0;
+    uint64_t blockOutputs = 0;
+    uint64_t voluntaryContextSwitches = 0;
+    uint64_t involuntaryContextSwitches = 0;
+};
+
 struct ProcessResult
 {
     int exitCode;
     std::string output;
+    ResourceUsage usage;
+    // Killed for running longer than the given timeout
+    bool timedOut = false;
 };
 
 // TODO: Maybe a fully separate OpenProcess or ShellExecute implementation on Windows
@@ -83,8 +126,14 @@ inline void runAndExit(const std::string& command)
     execvp(cArgs[0], cArgs.data());
 }
 
-inline ProcessResult run(std::string command, bool echoOutput = false)
+// Runs command in a shell and collects its output, which is also passed to
+// onOutput as it arrives. A timeout in seconds kills the command and
+// everything it started if it runs longer. Timeouts are not supported on Windows.
+#if _WIN32
+inline ProcessResult run(std::string command, bool echoOutput = false, double timeout = 0.0, const std::function<void(std::string_view)>& onOutput = {})
 {
+    auto startTime = std::chrono::steady_clock::now();
+
     ProcessResult result;
     {
         auto processPipe = popen(command.c_str(), "r");
@@ -104,6 +153,10 @@ inline ProcessResult run(std::string command, bool echoOutput = false)
                     std::cout.write(buffer.data(), bytesRead);
                     std::cout.flush();
                 }
+                if(onOutput)
+                {
+                    onOutput(std::string_view(buffer.data(), bytesRead));
+                }
             }
         }
         catch(...)
@@ -115,8 +168,258 @@ inline ProcessResult run(std::string command, bool echoOutput = false)
         result.exitCode = WEXITSTATUS(status);
     }
 
+    result.usage.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
     return result;
 }
+#else
+inline ProcessResult run(std::string command, bool echoOutput = false, double timeout = 0.0, const std::function<void(std::string_view)>& onOutput = {})
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    // The pipe must not leak into processes started concurrently on other threads
+    int pipeFds[2];
+#if __linux__
+    if(pipe2(pipeFds, O_CLOEXEC) != 0)
+#else
+    if(pipe(pipeFds) != 0 || fcntl(pipeFds[0], F_SETFD, FD_CLOEXEC) != 0 || fcntl(pipeFds[1], F_SETFD, FD_CLOEXEC) != 0)
+#endif
+    {
+        throw std::runtime_error("Failed to create pipe: " + std::string(strerror(errno)));
+    }
+
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_adddup2(&fileActions, pipeFds[1], STDOUT_FILENO);
+
+    char shell[] = "sh";
+    char shellFlag[] = "-c";
+    char* args[] = { shell, shellFlag, command.data(), nullptr };
+
+    // A command that can time out gets its own process group, so whatever
+    // the shell started can be killed along with it.
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    if(timeout > 0.0)
+    {
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attributes, 0);
+    }
+
+    pid_t pid;
+    int spawnError = posix_spawn(&pid, "/bin/sh", &fileActions, &attributes, args, environ);
+    posix_spawn_file_actions_destroy(&fileActions);
+    posix_spawnattr_destroy(&attributes);
+    close(pipeFds[1]);
+
+    if(spawnError != 0)
+    {
+        close(pipeFds[0]);
+        throw std::runtime_error("Failed to start process: " + std::string(strerror(spawnError)));
+    }
+
+    ProcessResult result;
+    int status = 0;
+    struct rusage usage = {};
+    auto reap = [&]()
+    {
+        while(wait4(pid, &status, 0, &usage) < 0 && errno == EINTR)
+        { }
+    };
+
+    try
+    {
+        auto deadline = startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+        std::array<char, 2048> buffer;
+        while(true)
+        {
+            if(timeout > 0.0)
+            {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                if(remaining <= 0)
+                {
+                    kill(-pid, SIGKILL);
+                    result.timedOut = true;
+                    break;
+                }
+
+                pollfd pollData = { pipeFds[0], POLLIN, 0 };
+                if(poll(&pollData, 1, (int)std::min<long long>(remaining, 1000)) <= 0)
+                {
+                    continue;
+                }
+            }
+
+            auto bytesRead = read(pipeFds[0], buffer.data(), buffer.size());
+            if(bytesRead < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(bytesRead <= 0)
+            {
+                break;
+            }
+            result.output.append(buffer.data(), bytesRead);
+            if(echoOutput)
+            {
+                std::cout.write(buffer.data(), bytesRead);
+                std::cout.flush();
+            }
+            if(onOutput)
+            {
+                onOutput(std::string_view(buffer.data(), bytesRead));
+            }
+        }
+    }
+    catch(...)
+    {
+        close(pipeFds[0]);
+        reap();
+        throw;
+    }
+    close(pipeFds[0]);
+    reap();
+
+    if(WIFEXITED(status))
+    {
+        result.exitCode = WEXITSTATUS(status);
+    }
+    else
+    {
+        // Same convention as the shell for processes killed by a signal
+        result.exitCode = 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+    }
+
+    auto toSeconds = [](const timeval& time) { return time.tv_sec + time.tv_usec / 1000000.0; };
+    result.usage.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    result.usage.userTime = toSeconds(usage.ru_utime);
+    result.usage.systemTime = toSeconds(usage.ru_stime);
+#if __APPLE__
+    result.usage.peakMemory = (uint64_t)usage.ru_maxrss;
+#else
+    result.usage.peakMemory = (uint64_t)usage.ru_maxrss * 1024;
+#endif
+    result.usage.blockInputs = (uint64_t)usage.ru_inblock;
+    result.usage.blockOutputs = (uint64_t)usage.ru_oublock;
+    result.usage.voluntaryContextSwitches = (uint64_t)usage.ru_nvcsw;
+    result.usage.involuntaryContextSwitches = (uint64_t)usage.ru_nivcsw;
+
+    return result;
+}
+#endif
+
+#if __linux__
+// CPU limit of a single cgroup, from either the v2 "cpu.max" or the v1
+// "cpu.cfs_quota_us" and "cpu.cfs_period_us" files.
+inline std::optional<size_t> readCgroupCpuLimit(const std::filesystem::path& dir)
+{
+    long long quota = -1;
+    long long period = 0;
+
+    std::ifstream cpuMax(dir / "cpu.max");
+    if(cpuMax)
+    {
+        std::string quotaStr;
+        cpuMax >> quotaStr >> period;
+        if(quotaStr != "max")
+        {
+            quota = std::atoll(quotaStr.c_str());
+        }
+    }
+    else
+    {
+        std::ifstream quotaFile(dir / "cpu.cfs_quota_us");
+        std::ifstream periodFile(dir / "cpu.cfs_period_us");
+        quotaFile >> quota;
+        periodFile >> period;
+    }
+
+    if(quota <= 0 || period <= 0)
+    {
+        return {};
+    }
+    return std::max((size_t)1, (size_t)((quota + period - 1) / period));
+}
+#endif
+
+// Number of CPUs this process can actually use. Besides the hardware
+// concurrency this respects the CPU affinity mask and, on Linux, cgroup CPU
+// quotas, which is how containers are usually limited.
+inline size_t availableConcurrency()
+{
+    size_t count = std::max((size_t)1, (size_t)std::thread::hardware_concurrency());
+
+#if __linux__
+    cpu_set_t cpuSet;
+    if(sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+    {
+        count = std::min(count, std::max((size_t)1, (size_t)CPU_COUNT(&cpuSet)));
+    }
+
+    // Lines are "hierarchy:controllers:path", with empty controllers for cgroup v2
+    std::ifstream cgroups("/proc/self/cgroup");
+    std::string line;
+    while(std::getline(cgroups, line))
+    {
+        auto first = line.find(':');
+        auto second = line.find(':', first == std::string::npos ? first : first+1);
+        if(second == std::string::npos)
+        {
+            continue;
+        }
+
+        auto controllers = "," + line.substr(first+1, second-first-1) + ",";
+        std::filesystem::path mount = "/sys/fs/cgroup";
+        if(controllers != ",,")
+        {
+            if(controllers.find(",cpu,") == std::string::npos)
+            {
+                continue;
+            }
+            std::error_code ec;
+            mount /= controllers.substr(1, controllers.size()-2);
+            if(!std::filesystem::exists(mount, ec))
+            {
+                mount = "/sys/fs/cgroup/cpu";
+            }
+        }
+
+        // Every ancestor's quota applies too. Without a cgroup namespace the
+        // path may not exist in the mounted hierarchy, in which case this ends
+        // up checking the mount root.
+        auto dir = mount / std::filesystem::path(line.substr(second+1)).relative_path();
+        while(true)
+        {
+            if(auto limit = readCgroupCpuLimit(dir))
+            {
+                count = std::min(count, *limit);
+            }
+            if(dir == mount || !dir.has_relative_path())
+            {
+                break;
+            }
+            dir = dir.parent_path();
+        }
+    }
+#endif
+
+    return count;
+}
+
+// One minute system load average, if the platform reports one.
+inline std::optional<double> loadAverage()
+{
+#if _WIN32
+    return {};
+#else
+    double load;
+    if(getloadavg(&load, 1) != 1)
+    {
+        return {};
+    }
+    return load;
+#endif
+}
 
 #if _WIN32
 #undef popen
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "util/string.h"
+
+// Timing of the phases of the generator process itself, printed as a summary
+// with --time-phases or written as a Chrome trace with --trace. Build
+// configurations can time their own work in configure() the same way:
+//
+//   profile::Scope scope("Generate sources");
+//
+// Scopes are cheap no-ops unless profiling was requested.
+namespace profile
+{
+
+class Profiler
+{
+public:
+    struct Record
+    {
+        std::string name;
+        std::string detail;
+        size_t thread;
+        size_t depth;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+    };
+
+    static Profiler& instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // Forgets previous records and starts recording if enabled.
+    void start(bool enabled)
+    {
+        std::scoped_lock lock(_mutex);
+        _records.clear();
+        _threads.clear();
+        _threads.emplace(std::this_thread::get_id(), 0);
+        _enabled = enabled;
+        _start = std::chrono::steady_clock::now();
+    }
+
+    bool enabled() const
+    {
+        return _enabled;
+    }
+
+    void record(Record record)
+    {
+        std::scoped_lock lock(_mutex);
+        auto it = _threads.emplace(std::this_thread::get_id(), _threads.size()).first;
+        record.thread = it->second;
+        _records.push_back(std::move(record));
+    }
+
+    // Total time per phase, in the order the phases started, indented by
+    // how deeply they were nested on the thread that ran them.
+    void printSummary(std::ostream& stream) const
+    {
+        struct Phase
+        {
+            std::string name;
+            size_t depth;
+            std::chrono::steady_clock::time_point first;
+            double seconds = 0.0;
+            size_t count = 0;
+        };
+
+        std::vector<Phase> phases;
+        {
+            std::scoped_lock lock(_mutex);
+            std::unordered_map<std::string, size_t> indices;
+            for(auto& record : _records)
+            {
+                auto [it, inserted] = indices.emplace(record.name, phases.size());
+                if(inserted)
+                {
+                    phases.push_back({ record.name, record.depth, record.start });
+                }
+                auto& phase = phases[it->second];
+                phase.depth = std::min(phase.depth, record.depth);
+                phase.first = std::min(phase.first, record.start);
+                phase.seconds += std::chrono::duration<double>(record.end - record.start).count();
+                ++phase.count;
+            }
+        }
+
+        std::stable_sort(phases.begin(), phases.end(), [](auto& a, auto& b) { return a.first < b.first; });
+
+        size_t nameWidth = 0;
+        for(auto& phase : phases)
+        {
+            nameWidth = std::max(nameWidth, phase.depth * 2 + phase.name.size());
+        }
+
+        stream << "Time spent per phase:\n";
+        for(auto& phase : phases)
+        {
+            std::ostringstream seconds;
+            seconds << std::fixed << std::setprecision(3) << phase.seconds << "s";
+            stream << "  " << str::padRightToSize(std::string(phase.depth * 2, ' ') + phase.name, nameWidth)
+                   << str::padLeftToSize(seconds.str(), 12);
+            if(phase.count > 1)
+            {
+                stream << "  (" << phase.count << " times)";
+            }
+            stream << "\n";
+        }
+    }
+
+    // Writes complete events in the Chrome trace event format, which can be
+    // opened in chrome://tracing or Perfetto.
+    void writeChromeTrace(const std::filesystem::path& path) const
+    {
+        std::ofstream stream(path, std::ios_base::binary);
+        if(!stream)
+        {
+            throw std::runtime_error("Failed to write trace to '" + path.string() + "'.");
+        }
+
+        auto microseconds = [this](std::chrono::steady_clock::time_point time)
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(time - _start).count();
+        };
+
+        std::scoped_lock lock(_mutex);
+        stream << "{\"traceEvents\":[\n";
+        bool first = true;
+        for(auto& record : _records)
+        {
+            stream << (first ? "" : ",\n")
+                   << "{\"name\":" << str::jsonQuote(record.name)
+                   << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << record.thread
+                   << ",\"ts\":" << microseconds(record.start)
+                   << ",\"dur\":" << microseconds(record.end) - microseconds(record.start);
+            if(!record.detail.empty())
+            {
+                stream << ",\"args\":{\"detail\":" << str::jsonQuote(record.detail) << "}";
+            }
+            stream << "}";
+            first = false;
+        }
+        for(size_t thread = 0; thread < _threads.size(); ++thread)
+        {
+            stream << (first ? "" : ",\n")
+                   << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+                   << ",\"args\":{\"name\":" << str::jsonQuote(thread == 0 ? "main" : "worker " + std::to_string(thread)) << "}}";
+            first = false;
+        }
+        stream << "\n]}\n";
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::atomic<bool> _enabled = false;
+    std::chrono::steady_clock::time_point _start;
+    std::vector<Record> _records;
+    std::unordered_map<std::thread::id, size_t> _threads;
+};
+
+// Times the rest of the enclosing block as the named phase. The optional
+// detail is shown in traces, but phases are summed by name alone.
+class Scope
+{
+public:
+    Scope(std::string_view name, std::string_view detail = {})
+    {
+        if(!Profiler::instance().enabled())
+        {
+            return;
+        }
+        _active = true;
+        _name = name;
+        _detail = detail;
+        _depth = depth()++;
+        _start = std::chrono::steady_clock::now();
+    }
+
+    Scope(const Scope& other) = delete;
+    Scope& operator=(const Scope& other) = delete;
+
+    ~Scope()
+    {
+        if(!_active)
+        {
+            return;
+        }
+        --depth();
+        Profiler::instance().record({ std::move(_name), std::move(_detail), 0, _depth, _start, std::chrono::steady_clock::now() });
+    }
+
+private:
+    static size_t& depth()
+    {
+        thread_local size_t depth = 0;
+        return depth;
+    }
+
+    bool _active = false;
+    std::string _name;
+    std::string _detail;
+    size_t _depth = 0;
+    std::chrono::steady_clock::time_point _start;
+};
+
+}
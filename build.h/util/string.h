@@ -175,6 +175,23 @@ inline std::pair<std::string, std::string> split(const std::string& str, char de
     }
 }
 
+inline std::vector<std::string_view> splitAll(std::string_view str, char delimiter)
+{
+    std::vector<std::string_view> result;
+    while(true)
+    {
+        auto pos = str.find(delimiter);
+        result.push_back(str.substr(0, pos));
+        if(pos == str.npos)
+        {
+            break;
+        }
+        str = str.substr(pos+1);
+    }
+
+    return result;
+}
+
 inline std::string quote(std::string str, char escapeChar = '\\', std::string_view escapedChars = "\"\\")
 {
     for(auto it = str.begin(); it != str.end(); ++it)
@@ -196,6 +213,40 @@ inline std::string quote(std::string_view str, char escapeChar = '\\', std::stri
     return quote(std::string(str), escapeChar, escapedChars);
 }
 
+// Quotes a string for JSON, also escaping control characters like newlines.
+inline std::string jsonQuote(std::string_view str)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    std::string result;
+    result.reserve(str.size() + 2);
+    result += '"';
+    for(char c : str)
+    {
+        switch(c)
+        {
+        case '"': result += "\\\""; break;
+        case '\\': result += "\\\\"; break;
+        case '\n': result += "\\n"; break;
+        case '\r': result += "\\r"; break;
+        case '\t': result += "\\t"; break;
+        default:
+            if((unsigned char)c < 0x20)
+            {
+                result += "\\u00";
+                result += hexDigits[(unsigned char)c >> 4];
+                result += hexDigits[(unsigned char)c & 0xf];
+            }
+            else
+            {
+                result += c;
+            }
+        }
+    }
+    result += '"';
+    return result;
+}
+
 inline std::string wrap(std::string_view str, size_t maxLength, size_t indent)
 {
     std::string result;
@@ -1,10 +1,14 @@
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #define CUSTOM_BUILD_H_MAIN
 #include "build.h"
 #undef INPUT
 #include "catch2/catch.hpp"
 
+#include "src/buildlog.h"
 #include "src/dependencyparser.h"
+#include "src/eventstream.h"
+#include "src/includescanner.h"
 
 TEST_CASE( "String utils" ) {
     CHECK(str::padLeft("test", 4) == "    test");
@@ -181,6 +185,9 @@ TEST_CASE( "Resolve Config" ) {
 
     SECTION("base no config") {
         auto resolved = baseProject.resolve("", OperatingSystem::current());
+        CHECK(resolved.memoryResource() != std::pmr::get_default_resource());
+        CHECK(resolved.ext<TestExt>().memoryResource() == resolved.memoryResource());
+        CHECK(baseProject.ext<TestExt>().memoryResource() == std::pmr::get_default_resource());
         CHECK(resolved.ext<TestExt>().localOption.value() == strvec{"None"});
         CHECK(resolved.ext<TestExt>().publicOption.value() == strvec{"P None"});
         CHECK(resolved.ext<TestExt>().publicOnlyOption.value() == strvec{});
@@ -243,6 +250,51 @@ TEST_CASE( "Resolve Config" ) {
     }
 }
 
+TEST_CASE( "Deferred properties" ) {
+    using strvec = std::vector<std::string>;
+
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+
+    int debugCalls = 0;
+    int releaseCalls = 0;
+    int outputCalls = 0;
+    Project& lib = env.createProject("Lib", StaticLib);
+    lib.defines += "FIRST";
+    lib.defines += deferred([&]() { ++debugCalls; return strvec{ "DEBUG", "FIRST", "EXTRA" }; });
+    lib.defines += "LAST";
+    lib(Public, "release").defines += deferred([&]() { ++releaseCalls; return std::string("RELEASE"); });
+    lib(Public).files += deferred([]() { return std::vector<std::filesystem::path>{ "a.cpp", "b.cpp" }; });
+    lib.output.stem = deferred([&]() { ++outputCalls; return std::string("deferred"); });
+
+    Project& app = env.createProject("App", Executable);
+    app.links += &lib;
+
+    CHECK(debugCalls == 0);
+    CHECK(lib.defines.value() == strvec{ "FIRST", "LAST" });
+
+    auto debug = lib.resolve("debug", OperatingSystem::current());
+    CHECK(debug.defines.value() == strvec{ "FIRST", "DEBUG", "EXTRA", "LAST" });
+    CHECK(debug.output.stem.value() == "deferred");
+    CHECK(debugCalls == 1);
+    CHECK(releaseCalls == 0);
+
+    auto release = lib.resolve("release", OperatingSystem::current());
+    CHECK(release.defines.value() == strvec{ "FIRST", "DEBUG", "EXTRA", "LAST", "RELEASE" });
+    CHECK(debugCalls == 1);
+    CHECK(releaseCalls == 1);
+    CHECK(outputCalls == 1);
+
+    auto appRelease = app.resolve("release", OperatingSystem::current());
+    CHECK(appRelease.defines.value() == strvec{ "RELEASE" });
+    REQUIRE(appRelease.files.value().size() == 2);
+    CHECK(appRelease.files.value()[1].path == "b.cpp");
+    CHECK(releaseCalls == 1);
+
+    lib.output.stem = "eager";
+    CHECK(lib.resolve("debug", OperatingSystem::current()).output.stem.value() == "eager");
+}
+
 TEST_CASE( "String util" ) {
     CHECK(str::trim(std::string(" \n \tsome text\t  \n")) == "some text");
     CHECK(str::trim(std::string("some text")) == "some text");
@@ -250,6 +302,53 @@ TEST_CASE( "String util" ) {
     CHECK(str::trim(std::string_view("some text")) == "some text");
 }
 
+TEST_CASE( "Arguments" ) {
+    std::vector<cli::Argument*> arguments;
+    cli::StringArgument jobs{arguments, "jobs", "Jobs.", {}, "j"};
+    cli::StringArgument load{arguments, "max-load", "Load.", {}, "l"};
+    cli::StringArgument config{arguments, "config", "Config."};
+    CHECK(jobs.example == "-j, --jobs=<value>");
+
+    SECTION("long names") {
+        cli::Context context({}, {}, { "build", "--jobs=4", "--max-load=2.5", "--config=debug" });
+        context.extractArguments(arguments);
+        CHECK(std::string(context.action) == "build");
+        CHECK(context.unusedArguments.empty());
+        CHECK(std::string(*jobs) == "4");
+        CHECK(std::string(*load) == "2.5");
+        CHECK(std::string(*config) == "debug");
+    }
+
+    SECTION("short names") {
+        cli::Context context({}, {}, { "build", "-j", "8", "-l3", "--other" });
+        context.extractArguments(arguments);
+        CHECK(context.unusedArguments == std::vector<std::string>{ "--other" });
+        CHECK(std::string(*jobs) == "8");
+        CHECK(std::string(*load) == "3");
+        CHECK(!config);
+    }
+
+    SECTION("missing value") {
+        cli::Context context({}, {}, { "build", "-j" });
+        CHECK_THROWS_AS(context.extractArguments(arguments), cli::argument_error);
+    }
+
+    SECTION("optional value") {
+        cli::FlagOrStringArgument stats{arguments, "stats", "Stats.", "10"};
+        CHECK(stats.example == "--stats[=<value>]");
+
+        cli::Context bare({}, {}, { "build", "--stats", "--statsx" });
+        bare.extractArguments(arguments);
+        CHECK(std::string(*stats) == "10");
+        CHECK(bare.unusedArguments == std::vector<std::string>{ "--statsx" });
+
+        cli::Context valued({}, {}, { "build", "--stats=20" });
+        valued.extractArguments(arguments);
+        CHECK(std::string(*stats) == "20");
+        CHECK(valued.unusedArguments.empty());
+    }
+}
+
 TEST_CASE( "Dependency Parser" ) {
     SECTION("gcc style") {
         std::string dependencyData = R"--( c:\asdf:
@@ -317,4 +416,961 @@ TEST_CASE( "Dependency Parser" ) {
             R"--(endoffile)--",
         });
     }
-}
\ No newline at end of file
+
+    SECTION("long paths") {
+        // Long enough for the scanner to cross several vector widths.
+        std::string longPath = "/a/rather/long/include/directory/that/goes/on/for/a/while";
+        std::string dependencyData = "out.o: " + longPath + "/x.h \\\n " + longPath + "/with\\ space/and\\ another.h " + longPath + "/last.h\n";
+
+        std::vector<std::string> result;
+        REQUIRE(!parseDependencyData(dependencyData, [&result](std::string_view path){
+            result.push_back(std::string(path));
+            return false;
+        }));
+        REQUIRE(result == std::vector<std::string>{
+            longPath + "/x.h",
+            longPath + "/with space/and another.h",
+            longPath + "/last.h",
+        });
+
+        size_t calls = 0;
+        REQUIRE(parseDependencyData(dependencyData, [&calls](std::string_view path){
+            ++calls;
+            return true;
+        }));
+        REQUIRE(calls == 1);
+    }
+}
+
+TEST_CASE( "Include scanner" ) {
+    SECTION("directives") {
+        std::string source = R"--(#include "quoted.h"
+  #  include <angled.h>
+#include MACRO_INCLUDE
+// #include "line_comment.h"
+/* #include "block_comment.h"
+#include "still_comment.h" */
+const char* text = "#include \"string.h\"";
+const char* raw = R"x(
+#include "raw_string.h"
+)x";
+int number = 1'000;
+#if 0
+#include "disabled.h"
+#if SOMETHING
+#include "nested_disabled.h"
+#else
+#include "nested_else.h"
+#endif
+#else
+#include "else_branch.h"
+#endif
+#ifdef SOMETHING
+#include "ifdef.h"
+#elif OTHER
+#include "elif.h"
+#endif
+#import "imported.h")--";
+
+        std::vector<std::string> result;
+        parseIncludeDirectives(source, [&result](std::string_view name, bool quoted){
+            result.push_back(std::string(quoted ? "q:" : "a:") + std::string(name));
+        });
+        REQUIRE(result == std::vector<std::string>{
+            "q:quoted.h",
+            "a:angled.h",
+            "q:else_branch.h",
+            "q:ifdef.h",
+            "q:elif.h",
+            "q:imported.h",
+        });
+    }
+
+    SECTION("resolving") {
+        auto dir = std::filesystem::temp_directory_path() / "build.h-tests" / "includescanner";
+        std::filesystem::remove_all(dir);
+        file::write(dir / "src" / "main.cpp", "#include \"local.h\"\n#include <lib/api.h>\n#include <vector>\n");
+        file::write(dir / "src" / "local.h", "#pragma once\n#include \"main_shadowed.h\"\n");
+        file::write(dir / "src" / "main_shadowed.h", "#include \"local.h\"\n");
+        file::write(dir / "include" / "lib" / "api.h", "#include \"detail.h\"\n#include <lib/api.h>\n");
+        file::write(dir / "include" / "lib" / "detail.h", "");
+
+        IncludeScanner scanner;
+        auto& headers = scanner.scan(dir / "src" / "main.cpp", { dir / "include" });
+        std::set<std::filesystem::path> headerSet(headers.begin(), headers.end());
+        CHECK(headers.size() == headerSet.size());
+        CHECK(headerSet == std::set<std::filesystem::path>{
+            (dir / "src" / "local.h").lexically_normal(),
+            (dir / "src" / "main_shadowed.h").lexically_normal(),
+            (dir / "include" / "lib" / "api.h").lexically_normal(),
+            (dir / "include" / "lib" / "detail.h").lexically_normal(),
+        });
+
+        // Angled includes don't search the including file's directory.
+        auto& withoutPaths = scanner.scan(dir / "src" / "main.cpp", {});
+        CHECK(withoutPaths.size() == 2);
+
+        auto results = scanner.scan({
+            { dir / "src" / "main.cpp", { dir / "include" } },
+            { dir / "include" / "lib" / "api.h", { dir / "include" } },
+            { dir / "src" / "local.h", {} },
+        }, 3);
+        REQUIRE(results.size() == 3);
+        CHECK(results[0] == headers);
+        CHECK(results[1] == std::vector<std::filesystem::path>{ (dir / "include" / "lib" / "detail.h").lexically_normal() });
+        CHECK(results[2] == std::vector<std::filesystem::path>{ (dir / "src" / "main_shadowed.h").lexically_normal() });
+
+        CHECK(IncludeScanner::isScannable("a.cpp"));
+        CHECK(IncludeScanner::isScannable("a.hpp"));
+        CHECK(!IncludeScanner::isScannable("a.o"));
+    }
+}
+
+TEST_CASE( "Event stream" ) {
+    CHECK(str::jsonQuote("plain") == "\"plain\"");
+    CHECK(str::jsonQuote("a \"quoted\"\\path\n\x01") == "\"a \\\"quoted\\\"\\\\path\\n\\u0001\"");
+
+    auto path = std::filesystem::temp_directory_path() / "build.h-tests" / "events.ndjson";
+    std::filesystem::create_directories(path.parent_path());
+    std::filesystem::remove(path);
+
+    for(int run = 0; run < 2; ++run)
+    {
+        EventStream events(path.string());
+        for(size_t i = 0; i < 100; ++i)
+        {
+            events.post(events.event("action_started").field("index", i).field("description", "Compiling \"x\"\n"));
+        }
+        events.post(events.event("build_finished").field("success", true));
+    }
+
+    auto data = file::read(path);
+    auto lines = str::splitAll(data, '\n');
+    REQUIRE(lines.size() == 203);
+    CHECK(lines.back().empty());
+    CHECK(str::startsWith(lines[0], "{\"type\":\"action_started\",\"time\":"));
+    CHECK(str::endsWith(lines[99], ",\"index\":99,\"description\":\"Compiling \\\"x\\\"\\n\"}"));
+    CHECK(str::endsWith(lines[100], ",\"success\":true}"));
+    CHECK(str::startsWith(lines[101], "{\"type\":\"action_started\""));
+
+#if !_WIN32
+    for(auto invalid : { "fd:", "fd:x", "fd:-1", "fd:+1", "fd: 1", "fd:1x", "fd:99999999999" })
+    {
+        INFO(invalid);
+        CHECK_THROWS_AS(EventStream(invalid), std::runtime_error);
+    }
+#endif
+}
+
+TEST_CASE( "MappedFile" ) {
+    auto dir = std::filesystem::temp_directory_path() / "build.h-tests";
+    std::filesystem::create_directories(dir);
+
+    SECTION("small file") {
+        file::write(dir / "small.txt", "small file contents");
+        file::MappedFile mapped(dir / "small.txt");
+        REQUIRE(mapped);
+        CHECK(mapped.view() == "small file contents");
+    }
+
+    SECTION("large file") {
+        std::string data;
+        for(size_t i = 0; data.size() < file::MappedFile::mapThreshold * 4; ++i)
+        {
+            data += std::to_string(i) + "\n";
+        }
+        file::write(dir / "large.txt", data);
+
+        file::MappedFile mapped(dir / "large.txt");
+        REQUIRE(mapped);
+        CHECK(mapped.view() == data);
+
+        file::MappedFile moved = std::move(mapped);
+        CHECK(!mapped);
+        CHECK(moved.view() == data);
+    }
+
+    SECTION("missing file") {
+        file::MappedFile mapped(dir / "does_not_exist.txt");
+        CHECK(!mapped);
+        CHECK(mapped.empty());
+    }
+}
+
+TEST_CASE( "WriteBatch" ) {
+    auto dir = std::filesystem::temp_directory_path() / "build.h-tests" / "writebatch";
+    std::filesystem::remove_all(dir);
+
+    {
+        file::WriteBatch batch(file::Durability::Synced);
+        CHECK(batch.write(dir / "a.txt", "first"));
+        CHECK(!batch.write(dir / "a.txt", "first"));
+        CHECK(batch.write(dir / "a.txt", "second"));
+        CHECK(batch.write(dir / "sub" / "b.txt", ""));
+        batch.commit();
+    }
+
+    CHECK(file::read(dir / "a.txt") == "second");
+    CHECK(std::filesystem::exists(dir / "sub" / "b.txt"));
+
+    size_t fileCount = 0;
+    for(auto& entry : std::filesystem::recursive_directory_iterator(dir))
+    {
+        fileCount += entry.is_regular_file() ? 1 : 0;
+    }
+    CHECK(fileCount == 2);
+
+#if !_WIN32
+    // Replacing a file keeps its permissions
+    auto perms = std::filesystem::perms::owner_read | std::filesystem::perms::owner_write | std::filesystem::perms::owner_exec;
+    std::filesystem::permissions(dir / "a.txt", perms);
+    CHECK(file::write(dir / "a.txt", "third"));
+    CHECK(std::filesystem::status(dir / "a.txt").permissions() == perms);
+#endif
+}
+
+TEST_CASE( "File actions" ) {
+    auto dir = std::filesystem::temp_directory_path() / "build.h-tests" / "fileactions";
+    std::filesystem::remove_all(dir);
+
+    SECTION("copy and touch") {
+        std::string data(100000, 'c');
+        file::write(dir / "source.txt", data);
+        file::write(dir / "target.txt", "previous contents that are longer than nothing");
+
+        std::error_code ec;
+        file::copy(dir / "source.txt", dir / "target.txt", ec);
+        CHECK(!ec);
+        CHECK(file::read(dir / "target.txt") == data);
+
+        file::copy(dir / "missing.txt", dir / "other.txt", ec);
+        CHECK(ec);
+
+        file::copy(dir / "source.txt", dir / "." / "source.txt", ec);
+        CHECK(ec);
+        CHECK(file::read(dir / "source.txt") == data);
+
+        file::touch(dir / "touched.txt", ec);
+        CHECK(!ec);
+        CHECK(std::filesystem::exists(dir / "touched.txt"));
+    }
+
+    SECTION("directory cache") {
+        file::DirectoryCache cache;
+        std::error_code ec;
+        cache.create(dir / "a" / "b", ec);
+        CHECK(!ec);
+        CHECK(std::filesystem::is_directory(dir / "a" / "b"));
+
+        // Known directories aren't checked again
+        std::filesystem::remove_all(dir / "a");
+        cache.create(dir / "a", ec);
+        CHECK(!std::filesystem::exists(dir / "a"));
+    }
+
+    SECTION("builtin commands") {
+        auto copy = commands::copy("from/file.txt", "to/file.txt");
+        REQUIRE(copy.builtins.size() == 2);
+        CHECK(copy.builtins[0].kind == BuiltinStep::Mkdir);
+        CHECK(copy.builtins[1].kind == BuiltinStep::Copy);
+
+        auto shell = CommandEntry{ "echo test" };
+        CHECK(commands::chain({ copy, commands::touch("stamp") }).builtins.size() == 3);
+        CHECK(commands::chain({ copy, shell }).builtins.empty());
+        CHECK(commands::chain({ shell, copy }).builtins.empty());
+    }
+
+    SECTION("command prefixes") {
+        CommandEntry a{ " -c a.cpp" };
+        a.commandPrefix = "cc -O2";
+        CommandEntry b = a;
+        CHECK(a == b);
+        CHECK(std::hash<CommandEntry>{}(a) == std::hash<CommandEntry>{}(b));
+        CHECK(a.commandLine() == "cc -O2 -c a.cpp");
+
+        b.commandPrefix = "cc -O0";
+        CHECK(!(a == b));
+
+        auto chained = commands::chain({ a, b });
+        CHECK(chained.commandPrefix.cstr() == a.commandPrefix.cstr());
+        CHECK(chained.commandLine() == "cc -O2 -c a.cpp && cc -O0 -c a.cpp");
+    }
+}
+
+TEST_CASE( "Callable actions" ) {
+    // Actions are registered globally, so they're cleared even if a check
+    // fails, for the case to be run again
+    struct ClearActions
+    {
+        ~ClearActions() { CallableActions::clear(); }
+    } clearActions;
+
+    std::vector<std::filesystem::path> seenOutputs;
+    auto command = commands::callable("tests.generate", "1", { "in.txt" }, { "out.txt" }, [&](auto& inputs, auto& outputs) {
+        seenOutputs = outputs;
+    });
+
+    CHECK(command.command == "callable tests.generate 1");
+    CHECK(command.inputs == std::vector<std::filesystem::path>{ "in.txt" });
+    CHECK(command.outputs == std::vector<std::filesystem::path>{ "out.txt" });
+
+    auto action = CallableActions::find("tests.generate");
+    REQUIRE(action == command.callable.get());
+    action->function(action->inputs, action->outputs);
+    CHECK(seenOutputs == std::vector<std::filesystem::path>{ "out.txt" });
+
+    CHECK_THROWS(commands::callable("tests.generate", "2", {}, {}, [](auto&, auto&) {}));
+    CHECK_THROWS(commands::chain({ command, commands::touch("stamp") }));
+    CHECK(!CallableActions::find("tests.missing"));
+}
+
+TEST_CASE( "Parallel configure" ) {
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+
+    auto root = std::filesystem::temp_directory_path() / "build.h-tests" / "parallel";
+    std::filesystem::remove_all(root);
+    std::vector<std::filesystem::path> dirs;
+    for(int i = 0; i < 16; ++i)
+    {
+        dirs.push_back(root / ("dir" + std::to_string(i)));
+        std::filesystem::create_directories(dirs.back());
+        for(int j = 0; j < 3; ++j)
+        {
+            std::ofstream(dirs.back() / ("file" + std::to_string(2 - j) + ".cpp"));
+        }
+    }
+
+    CHECK(glob::directories(root).size() == dirs.size());
+
+    env.parallelFor(dirs, [&](const std::filesystem::path& dir) {
+        Project& project = env.createProject(dir.filename().string(), StaticLib);
+        project.files += glob::files(dir);
+        project.defines += "NAME_" + dir.filename().string();
+
+        env.parallelFor(std::vector<int>{ 0, 1 }, [&](int index) {
+            env.createProject(dir.filename().string() + "_" + std::to_string(index));
+        });
+    });
+    std::filesystem::remove_all(root);
+
+    auto projects = env.collectProjects();
+    REQUIRE(projects.size() == 1 + dirs.size() * 3);
+    CHECK(projects[0] == &env.defaults);
+    for(size_t i = 0; i < dirs.size(); ++i)
+    {
+        auto name = "dir" + std::to_string(i);
+        CHECK(projects[1 + i * 3]->name == name);
+        CHECK(projects[2 + i * 3]->name == name + "_0");
+        CHECK(projects[3 + i * 3]->name == name + "_1");
+        CHECK(env.findProject(name) == projects[1 + i * 3]);
+
+        auto& files = projects[1 + i * 3]->files.value();
+        REQUIRE(files.size() == 3);
+        CHECK(files[0].path.filename() == "file0.cpp");
+        CHECK(files[2].path.filename() == "file2.cpp");
+    }
+
+    CHECK_THROWS_WITH(env.parallelFor(std::vector<int>{ 0, 1, 2, 3 }, [](int index) {
+        if(index >= 2)
+        {
+            throw std::runtime_error("task " + std::to_string(index));
+        }
+    }), "task 2");
+}
+
+TEST_CASE( "Shared objects" ) {
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+    GccLikeToolchainProvider toolchain("test", "cc", "cc", "ar");
+
+    auto objectOf = [&](Project& project, std::filesystem::path dataDir = "out", std::filesystem::path sharedDataDir = {}) {
+        auto resolved = project.resolve({}, OperatingSystem::current());
+        resolved.dataDir = dataDir;
+        resolved.sharedDataDir = sharedDataDir;
+        toolchain.process(project, resolved, {}, {});
+        REQUIRE(!resolved.commands.value().empty());
+        return resolved.commands.value().front().outputs.front();
+    };
+
+    Project& a = env.createProject("A", Executable);
+    a.files += "shared.cpp";
+    Project& b = env.createProject("B", Executable);
+    b.files += "shared.cpp";
+    CHECK(objectOf(a) != objectOf(b));
+
+    env.defaults(Public).features += feature::SharedObjects;
+    CHECK(objectOf(a) == objectOf(b));
+    CHECK(objectOf(a).filename() == "shared.cpp.o");
+
+    // Configurations share objects through the shared data directory
+    CHECK(objectOf(a, "out/debug", "out/shared") == objectOf(a, "out/release", "out/shared"));
+    CHECK(str::startsWith(objectOf(a, "out/debug", "out/shared").string(), "out/shared"));
+
+    b.defines += "DIFFERENT";
+    CHECK(objectOf(a) != objectOf(b));
+}
+
+TEST_CASE( "Interface stubs" ) {
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+    GccLikeToolchainProvider toolchain("test", "cc", "cc", "ar");
+
+    Project& lib = env.createProject("Lib", SharedLib);
+    lib.files += "lib.cpp";
+    Project& app = env.createProject("App", Executable);
+    app.files += "app.cpp";
+    app.links += &lib;
+
+    auto process = [&](Project& project) {
+        auto resolved = project.resolve({}, OperatingSystem::current());
+        resolved.dataDir = "out";
+        toolchain.process(project, resolved, {}, {});
+        return resolved.commands.value();
+    };
+
+    auto libCommands = process(lib);
+    REQUIRE(libCommands.size() == 3);
+    auto& stub = libCommands.back();
+    CHECK(stub.restat);
+    REQUIRE(stub.outputs.size() == 1);
+    CHECK(stub.outputs.front().extension() == ".toc");
+
+    // The dependent depends on the stub but links the library itself
+    auto appCommands = process(app);
+    auto& link = appCommands.back();
+    auto libraryOutput = libCommands[1].outputs.front();
+    CHECK(std::find(link.inputs.begin(), link.inputs.end(), stub.outputs.front()) != link.inputs.end());
+    CHECK(std::find(link.inputs.begin(), link.inputs.end(), libraryOutput) == link.inputs.end());
+    CHECK(link.command.find(libraryOutput.string()) != std::string::npos);
+}
+
+TEST_CASE( "Precompiled headers" ) {
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+    GccLikeToolchainProvider toolchain("test", "cc", "cc", "ar");
+
+    auto process = [&](Project& project) {
+        auto resolved = project.resolve({}, OperatingSystem::current());
+        resolved.dataDir = "out";
+        toolchain.process(project, resolved, {}, {});
+        return resolved.commands.value();
+    };
+
+    Project& a = env.createProject("A", Executable);
+    a.files += "a.cpp";
+    a.importPch = "pch.h";
+    Project& b = env.createProject("B", Executable);
+    b.files += { "b.cpp", "b.c" };
+    b.importPch = "pch.h";
+
+    // Only the languages in use get a variant
+    auto aCommands = process(a);
+    REQUIRE(aCommands.size() == 3);
+    auto pch = aCommands[0].outputs.front();
+    CHECK(pch.extension() == (toolchain.isClang() ? ".pch" : ".gch"));
+    CHECK(std::find(aCommands[1].inputs.begin(), aCommands[1].inputs.end(), pch) != aCommands[1].inputs.end());
+    CHECK(std::string_view(aCommands[1].commandPrefix).find(toolchain.isClang() ? "-include-pch" : "-include") != std::string_view::npos);
+
+    // Projects with the same flags share the C++ variant
+    auto bCommands = process(b);
+    REQUIRE(bCommands.size() == 5);
+    CHECK(bCommands[0].outputs.front() == pch);
+    CHECK(bCommands[1].outputs.front() != pch);
+}
+
+TEST_CASE( "Hashing" ) {
+    SECTION("sha256 known answers") {
+        CHECK(hash::toHex(hash::sha256("")) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        CHECK(hash::toHex(hash::sha256("abc")) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        CHECK(hash::toHex(hash::sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+        CHECK(hash::toHex(hash::sha256(std::string(1000000, 'a'))) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    }
+
+    SECTION("murmur3 verification value") {
+        uint8_t key[256];
+        uint8_t hashes[256 * 16];
+        for(int i = 0; i < 256; ++i)
+        {
+            key[i] = (uint8_t)i;
+            hash::Murmur3Digester digester(256 - i);
+            digester.digest(std::string_view((const char*)key, i));
+            auto digest = digester.finalize();
+            memcpy(hashes + i*16, digest.data(), 16);
+        }
+
+        auto final = hash::fingerprint(std::string_view((const char*)hashes, sizeof(hashes)));
+        uint32_t verification = final[0] | (final[1] << 8) | (final[2] << 16) | ((uint32_t)final[3] << 24);
+        CHECK(verification == 0x6384BA69);
+
+        CHECK(hash::toHex(hash::fingerprint("")) == "00000000000000000000000000000000");
+    }
+
+    SECTION("streaming matches one-shot") {
+        std::string data;
+        for(int i = 0; i < 10000; ++i)
+        {
+            data += (char)(i * 7 + i / 13);
+        }
+
+        for(size_t chunkSize : { 1, 3, 15, 63, 64, 65, 1000 })
+        {
+            hash::Sha256Digester sha;
+            hash::Murmur3Digester murmur;
+            for(size_t pos = 0; pos < data.size(); pos += chunkSize)
+            {
+                sha.digest(std::string_view(data).substr(pos, chunkSize));
+                murmur.digest(std::string_view(data).substr(pos, chunkSize));
+            }
+            CHECK(sha.finalize() == hash::sha256(data));
+            CHECK(murmur.finalize() == hash::fingerprint(data));
+        }
+    }
+
+    SECTION("files") {
+        auto dir = std::filesystem::temp_directory_path() / "build.h-tests" / "hash";
+        std::string data(100000, 'x');
+        file::write(dir / "file.txt", data);
+        CHECK(hash::digestFile<hash::Sha256Digester>(dir / "file.txt") == hash::sha256(data));
+        CHECK(hash::digestFile<hash::Murmur3Digester>(dir / "file.txt") == hash::fingerprint(data));
+        CHECK(!hash::digestFile<hash::Sha256Digester>(dir / "does_not_exist.txt"));
+    }
+}
+
+TEST_CASE( "Process" ) {
+#if !_WIN32
+    SECTION("output and exit code") {
+        auto result = process::run("echo hello && exit 3");
+        CHECK(result.output == "hello\n");
+        CHECK(result.exitCode == 3);
+    }
+
+    SECTION("resource usage") {
+        auto result = process::run("i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done");
+        CHECK(result.exitCode == 0);
+        CHECK(result.usage.wallTime > 0.0);
+        CHECK(result.usage.userTime + result.usage.systemTime > 0.0);
+        CHECK(result.usage.peakMemory > 0);
+    }
+
+    SECTION("timeout") {
+        auto result = process::run("echo started && sleep 10 && echo finished", false, 0.5);
+        CHECK(result.timedOut);
+        CHECK(result.exitCode != 0);
+        CHECK(result.output == "started\n");
+        CHECK(result.usage.wallTime < 5.0);
+
+        result = process::run("echo quick", false, 10.0);
+        CHECK(!result.timedOut);
+        CHECK(result.exitCode == 0);
+        CHECK(result.output == "quick\n");
+    }
+#endif
+
+    SECTION("available concurrency") {
+        auto count = process::availableConcurrency();
+        CHECK(count >= 1);
+        CHECK(count <= std::max((size_t)1, (size_t)std::thread::hardware_concurrency()));
+    }
+
+    SECTION("build log") {
+        auto path = std::filesystem::temp_directory_path() / "build.h-tests" / "buildlog" / ".buildlog";
+        std::filesystem::remove_all(path.parent_path());
+
+        process::ResourceUsage usage;
+        usage.wallTime = 1.5;
+        usage.peakMemory = 3 * 1024 * 1024;
+        {
+            BuildLog log(path);
+            log.record("out/a.o", "Compiling\ta.cpp", usage);
+            log.write();
+        }
+
+        BuildLog log(path);
+        std::ostringstream report;
+        log.printReport(report, 10);
+        CHECK(report.str() == "Top 1 by wall time:\n       1.50s  Compiling a.cpp\nTop 1 by peak memory:\n       3.0MB  Compiling a.cpp\n");
+    }
+}
+
+TEST_CASE( "Memory usage" ) {
+    SECTION("heap size") {
+        CHECK(memory::heapSize(std::string("short")) == 0);
+        CHECK(memory::heapSize(std::string(100, 'x')) >= 101);
+
+        std::vector<std::string> strings(4, std::string(100, 'x'));
+        CHECK(memory::heapSize(strings) >= 4 * sizeof(std::string) + 4 * 101);
+
+        PropertyBag bag;
+        ListProperty<std::string> property{&bag};
+        size_t emptySize = bag.heapSize();
+        property += std::string(100, 'x');
+        CHECK(bag.heapSize() >= emptySize + sizeof(std::string) + 101);
+    }
+
+    SECTION("report") {
+        memory::Report report;
+        report.add("Strings", 2, 1000);
+        report.add("Commands", 1, 3 * 1024 * 1024);
+        report.add("Strings", 1, 536);
+
+        std::ostringstream stream;
+        report.print(stream);
+        CHECK(stream.str() == "  Strings            3 objects       1.5kB\n  Commands           1 objects       3.0MB\n");
+    }
+}
+
+TEST_CASE( "Phase timing" ) {
+    auto& profiler = profile::Profiler::instance();
+
+    profiler.start(false);
+    {
+        profile::Scope scope("Ignored");
+    }
+
+    profiler.start(true);
+    {
+        profile::Scope outer("Outer");
+        for(int i = 0; i < 2; ++i)
+        {
+            profile::Scope inner("Inner", "detail");
+        }
+        std::thread([](){ profile::Scope scope("Worker"); }).join();
+    }
+
+    std::ostringstream summary;
+    profiler.printSummary(summary);
+    auto text = summary.str();
+    CHECK(text.find("Ignored") == std::string::npos);
+    CHECK(text.find("  Outer") < text.find("    Inner"));
+    CHECK(text.find("(2 times)") != std::string::npos);
+
+    auto tracePath = std::filesystem::temp_directory_path() / "build.h-tests" / "trace.json";
+    std::filesystem::create_directories(tracePath.parent_path());
+    profiler.writeChromeTrace(tracePath);
+    std::ifstream stream(tracePath);
+    std::string trace((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    std::filesystem::remove(tracePath);
+    CHECK(str::startsWith(trace, "{\"traceEvents\":["));
+    CHECK(trace.find("\"name\":\"Inner\",\"ph\":\"X\",\"pid\":1,\"tid\":0") != std::string::npos);
+    CHECK(trace.find("\"args\":{\"detail\":\"detail\"}") != std::string::npos);
+    CHECK(trace.find("\"name\":\"Worker\",\"ph\":\"X\",\"pid\":1,\"tid\":1") != std::string::npos);
+
+    profiler.start(false);
+}
+
+TEST_CASE( "Compile commands" ) {
+    auto root = std::filesystem::temp_directory_path() / "build.h-tests" / "compilecommands";
+    std::filesystem::remove_all(root);
+    auto database = root / "compile_commands.json";
+
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+    Project& project = env.createProject("Generated", Command);
+    project.commands += CommandEntry{ "generate first.txt", { "first.txt" }, { "first.out" } };
+    project.commands += CommandEntry{ "generate", {}, { "none.out" } };
+
+    auto& emitter = CompileCommands::instance;
+    auto previousTargetPath = emitter.targetPath.value;
+    emitter.targetPath.value = root;
+
+    emitter.emit(env);
+    auto data = file::read(database);
+    CHECK(data.find("\"file\": \"first.txt\"") != std::string::npos);
+    CHECK(data.find("\"command\": \"generate first.txt\"") != std::string::npos);
+    CHECK(data.find("none.out") == std::string::npos);
+
+    // Emitting the same commands again leaves the database untouched
+    auto oldTime = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    std::filesystem::last_write_time(database, oldTime);
+    emitter.emit(env);
+    CHECK(std::filesystem::last_write_time(database) == oldTime);
+
+    project.commands += CommandEntry{ "generate second.txt", { "second.txt" }, { "second.out" } };
+    emitter.emit(env);
+    CHECK(std::filesystem::last_write_time(database) != oldTime);
+    data = file::read(database);
+    CHECK(data.find("\"file\": \"first.txt\"") != std::string::npos);
+    CHECK(data.find("\"file\": \"second.txt\"") != std::string::npos);
+
+    emitter.targetPath.value = previousTargetPath;
+}
+
+TEST_CASE( "Affected projects" ) {
+    auto root = std::filesystem::temp_directory_path() / "build.h-tests" / "affected";
+    std::filesystem::remove_all(root);
+    file::write(root / "lib.cpp", "#include \"recorded.h\"\n#include \"unrecorded.h\"\n");
+    file::write(root / "recorded.h", "");
+    file::write(root / "unrecorded.h", "");
+    file::write(root / "lib.d", (root / "lib.o").string() + ": " + (root / "lib.cpp").string() + " " + (root / "recorded.h").string() + "\n");
+    file::write(root / "scanned.cpp", "#include \"scanned.h\"\n");
+    file::write(root / "scanned.h", "");
+
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+
+    // Lib has recorded its headers in a dependency file, while scanned.cpp
+    // hasn't been built yet, so its includes are scanned
+    Project& lib = env.createProject("Lib", Command);
+    CommandEntry compile{ "compile", { root / "lib.cpp" }, { root / "lib.o" } };
+    compile.depFile = root / "lib.d";
+    lib.commands += compile;
+    CommandEntry scanned{ "compile", { root / "scanned.cpp" }, { root / "scanned.o" } };
+    scanned.depFile = root / "scanned.d";
+    lib.commands += scanned;
+
+    Project& app = env.createProject("App", Command);
+    app.links += &lib;
+    app.commands += CommandEntry{ "link", { root / "lib.o" }, { root / "app" } };
+
+    Project& other = env.createProject("Other", Command);
+    other.commands += CommandEntry{ "compile", { root / "other.cpp" }, { root / "other.o" } };
+
+    auto& query = Query::instance;
+    auto previousTargetPath = query.targetPath.value;
+    query.targetPath.value = root / "out";
+
+    auto affected = [&](std::vector<std::filesystem::path> files) {
+        std::string fileList;
+        for(auto& file : files)
+        {
+            fileList += (fileList.empty() ? "" : ",") + (root / file).string();
+        }
+        query.affectedFiles.value = fileList;
+
+        std::ostringstream stream;
+        auto previousBuffer = std::cout.rdbuf(stream.rdbuf());
+        query.emitAffected(env);
+        std::cout.rdbuf(previousBuffer);
+        return stream.str();
+    };
+
+    // Lib is built anyway as a dependency of App, so only App is listed
+    CHECK(affected({ "lib.cpp" }) == "App\n");
+    CHECK(affected({ "recorded.h" }) == "App\n");
+    // A dependency file takes precedence over scanning the source
+    CHECK(affected({ "unrecorded.h" }) == "");
+    // Nothing consumes scanned.o, so Lib has to be listed itself
+    CHECK(affected({ "scanned.h" }) == "Lib\n");
+    CHECK(affected({ "scanned.h", "other.cpp" }) == "Lib\nOther\n");
+    CHECK(affected({ "recorded.h", "scanned.h", "other.cpp" }) == "App\nOther\n");
+    CHECK(affected({ "unknown.cpp" }) == "");
+
+    // Shared objects, and their dependency files, are found in the shared
+    // data directory like the builder places them
+    GccLikeToolchainProvider toolchain("test", "cc", "cc", "ar");
+    file::write(root / "shared.cpp", "#include SELECTED_HEADER\n");
+    file::write(root / "selected.h", "");
+    Project& shared = env.createProject("Shared", Executable);
+    shared.toolchain = &toolchain;
+    shared.features += feature::SharedObjects;
+    shared.files += root / "shared.cpp";
+
+    auto resolved = shared.resolve({}, OperatingSystem::current());
+    resolved.dataDir = root / "out";
+    resolved.sharedDataDir = root / "out" / "_shared";
+    toolchain.process(shared, resolved, {}, {});
+    auto& sharedCompile = resolved.commands.value().front();
+    REQUIRE(str::startsWith(sharedCompile.depFile.string(), (root / "out" / "_shared").string()));
+    file::write(sharedCompile.depFile, sharedCompile.outputs.front().string() + ": " + (root / "shared.cpp").string() + " " + (root / "selected.h").string() + "\n");
+
+    // Scanning can't tell which header the macro selects
+    CHECK(affected({ "selected.h" }) == "Shared\n");
+
+    query.affectedFiles.value.reset();
+    query.targetPath.value = previousTargetPath;
+}
+
+#if !_WIN32
+// Links nothing, but reports a prebuilt script as the output, so tests can be
+// run without compiling anything.
+struct ScriptToolchainProvider : public ToolchainProvider
+{
+    ScriptToolchainProvider(std::filesystem::path script)
+        : ToolchainProvider("script")
+        , script(std::move(script))
+    { }
+
+    std::vector<std::filesystem::path> process(Project& project, ProjectSettings& resolvedSettings, StringId config, const std::filesystem::path& workingDir) const override
+    {
+        return { script };
+    }
+
+    std::filesystem::path script;
+};
+
+TEST_CASE( "Test runner" ) {
+    auto root = std::filesystem::temp_directory_path() / "build.h-tests" / "testrunner";
+    std::filesystem::remove_all(root);
+    auto script = root / "exit.sh";
+    file::write(script, "#!/bin/sh\nexit $1\n");
+    std::filesystem::permissions(script, std::filesystem::perms::owner_all);
+    ScriptToolchainProvider toolchain(script);
+
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+    Project& project = env.createProject("Checked", Executable);
+    project.toolchain = &toolchain;
+    project.ext<extensions::Test>().enabled = true;
+    project.ext<extensions::Test>().arguments += "0";
+    auto stamp = root / "out" / "tests" / "Checked.passed";
+
+    auto& builder = DirectBuilder::instance;
+    auto previousTargetPath = builder.targetPath.value;
+    builder.targetPath.value = root / "out";
+    builder.runTests.value = true;
+    auto build = [&]() { return builder.buildConfig(env, env.collectProjects(), {}, 1, {}, {}, nullptr); };
+
+    CHECK(build() == 0);
+    CHECK(std::filesystem::exists(stamp));
+
+    SECTION("failing after passing") {
+        project.ext<extensions::Test>().arguments = std::vector<std::string>{ "1" };
+        CHECK(build() == 1);
+        CHECK(!std::filesystem::exists(stamp));
+        CHECK(build() == 1);
+
+        project.ext<extensions::Test>().arguments = std::vector<std::string>{ "0" };
+        CHECK(build() == 0);
+        CHECK(std::filesystem::exists(stamp));
+    }
+
+    SECTION("changed without running tests") {
+        builder.runTests.value = false;
+        project.ext<extensions::Test>().arguments = std::vector<std::string>{ "1" };
+        CHECK(build() == 0);
+        CHECK(!std::filesystem::exists(stamp));
+
+        builder.runTests.value = true;
+        CHECK(build() == 1);
+    }
+
+    builder.runTests.value = false;
+    builder.targetPath.value = previousTargetPath;
+}
+
+TEST_CASE( "Duplicate commands" ) {
+    auto root = std::filesystem::temp_directory_path() / "build.h-tests" / "duplicatecommands";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    auto output = root / "shared.txt";
+
+    cli::Context cliContext({}, {}, {});
+    Environment env(cliContext);
+    Project& a = env.createProject("A", Command);
+    a.commands += CommandEntry{ "echo A >> " + output.string(), {}, { output } };
+    Project& b = env.createProject("B", Command);
+
+    auto& builder = DirectBuilder::instance;
+    auto previousTargetPath = builder.targetPath.value;
+    builder.targetPath.value = root / "out";
+    auto build = [&]() { return builder.buildConfig(env, env.collectProjects(), {}, 1, {}, {}, nullptr); };
+
+    SECTION("identical") {
+        b.commands += CommandEntry{ "echo A >> " + output.string(), {}, { output } };
+        build();
+        CHECK(file::read(output) == "A\n");
+    }
+
+    SECTION("conflicting") {
+        b.commands += CommandEntry{ "echo B >> " + output.string(), {}, { output } };
+        CHECK_THROWS_WITH(build(), "Conflicting commands for output '" + output.string() + "'.");
+        CHECK(!std::filesystem::exists(output));
+    }
+
+    SECTION("conflicting extra outputs") {
+        b.commands += CommandEntry{ "echo A >> " + output.string(), {}, { output, root / "extra.txt" } };
+        CHECK_THROWS_AS(build(), std::runtime_error);
+    }
+
+    builder.targetPath.value = previousTargetPath;
+}
+
+TEST_CASE( "Test shards" ) {
+    SECTION("parsing") {
+        CHECK(DirectBuilder::parseTestShard("0/1") == std::pair<size_t, size_t>{ 0, 1 });
+        CHECK(DirectBuilder::parseTestShard("2/3") == std::pair<size_t, size_t>{ 2, 3 });
+        for(auto invalid : { "", "1", "/", "1/", "/2", "3/3", "-1/2", "0/0", "a/2", "1/b", " 1/2", "1/2/3", "+1/2" })
+        {
+            CHECK_THROWS_AS(DirectBuilder::parseTestShard(invalid), cli::argument_error);
+        }
+    }
+
+    SECTION("selection") {
+        auto root = std::filesystem::temp_directory_path() / "build.h-tests" / "testshards";
+        std::filesystem::remove_all(root);
+        auto script = root / "record.sh";
+        file::write(script, "#!/bin/sh\necho \"$1\" >> \"$2\"\n");
+        std::filesystem::permissions(script, std::filesystem::perms::owner_all);
+        ScriptToolchainProvider toolchain(script);
+        auto log = root / "runs.txt";
+
+        cli::Context cliContext({}, {}, {});
+        Environment env(cliContext);
+        // Created out of order, since shards are taken in name order
+        for(auto name : { "D", "B", "A", "C", "E" })
+        {
+            Project& project = env.createProject(name, Executable);
+            project.toolchain = &toolchain;
+            project.ext<extensions::Test>().enabled = true;
+            project.ext<extensions::Test>().arguments += { std::string(name), log.string() };
+        }
+
+        auto& builder = DirectBuilder::instance;
+        auto previousTargetPath = builder.targetPath.value;
+        builder.targetPath.value = root / "out";
+        builder.runTests.value = true;
+        auto runs = [&]() {
+            std::vector<std::string> names;
+            std::ifstream stream(log);
+            for(std::string line; std::getline(stream, line);)
+            {
+                names.push_back(line);
+            }
+            std::sort(names.begin(), names.end());
+            std::filesystem::remove(log);
+            return names;
+        };
+
+        CHECK(builder.buildConfig(env, env.collectProjects(), {}, 1, {}, std::pair<size_t, size_t>{ 1, 2 }, nullptr) == 0);
+        CHECK(runs() == std::vector<std::string>{ "B", "D" });
+
+        // Tests that already passed aren't run again
+        CHECK(builder.buildConfig(env, env.collectProjects(), {}, 1, {}, {}, nullptr) == 0);
+        CHECK(runs() == std::vector<std::string>{ "A", "C", "E" });
+        CHECK(builder.buildConfig(env, env.collectProjects(), {}, 1, {}, {}, nullptr) == 0);
+        CHECK(runs().empty());
+
+        builder.runTests.value = false;
+        builder.targetPath.value = previousTargetPath;
+    }
+}
+#endif
+
+TEST_CASE( "Hashing benchmark", "[.][benchmark]" ) {
+    auto path = std::filesystem::temp_directory_path() / "build.h-tests" / "hash" / "benchmark.bin";
+    std::string data(64 * 1024 * 1024, '\0');
+    for(size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (char)(i * 2654435761u >> 24);
+    }
+    file::write(path, data);
+
+    BENCHMARK("read") {
+        file::MappedFile mapped(path);
+        size_t sum = 0;
+        for(size_t i = 0; i < mapped.size(); i += 4096)
+        {
+            sum += (uint8_t)mapped.data()[i];
+        }
+        return sum;
+    };
+
+    BENCHMARK("fingerprint") {
+        return hash::digestFile<hash::Murmur3Digester>(path);
+    };
+
+    BENCHMARK("sha256") {
+        return hash::digestFile<hash::Sha256Digester>(path);
+    };
+}